@@ -18,6 +18,12 @@ bool IsTabletPenInProximity();
 bool ConsumeTabletPenPressed();
 bool ConsumeTabletPenReleased();
 
+// true if any SDL event was queued since the last call
+bool ConsumeSDLActivity();
+// sleeps until an event is queued or timeout seconds pass (negative waits
+// for good), the event stays queued for raylib to poll
+void WaitForSDLEvent(double timeout);
+
 bool SDLCALL WatchSDLEvent(void* userdata, SDL_Event* event);
 
 #endif
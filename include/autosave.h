@@ -0,0 +1,116 @@
+#pragma once
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "canvas_file.h"
+#include "gpu.h"
+#include "layer.h"
+#include "thread_pool.h"
+
+#define AUTOSAVE_JOURNAL_MAGIC "MYCJ"
+#define AUTOSAVE_JOURNAL_VERSION 1
+#define AUTOSAVE_DEFAULT_INTERVAL 30.0
+#define AUTOSAVE_DEFAULT_BUDGET 0.002
+#define AUTOSAVE_MAX_IN_FLIGHT 32
+
+// <file>.journal layout, all integers little endian:
+//
+//   header   magic[4] version:u32 width:u32 height:u32 tileSize:u32 baseBytes:u64
+//   records  size:u32 checksum:u32 body[size]
+//   body     layerCount:u32 layerCount * (opacity:u8 pad[3] blendMode:i32)
+//            tileCount:u32 tileCount * (layer:u32 tileX:u32 tileY:u32 size:u32 deflated[size])
+//
+// Tiles use the .mc tile grid and texture row order, size 0 is an all
+// zero tile. baseBytes is the size of the .mc the records apply on top
+// of, 0 for a canvas that was never saved. Records only ever get
+// appended, so a crash can at worst tear the last one, which the
+// checksum catches.
+
+struct JournalTile {
+	uint32_t layer;
+	uint32_t tileX;
+	uint32_t tileY;
+	std::vector<unsigned char> pixels;  // empty for an all zero tile
+};
+
+struct JournalRecord {
+	std::vector<CanvasFileLayer> layers;  // opacity and blend mode only
+	std::vector<JournalTile> tiles;
+};
+
+struct Journal {
+	int width = 0;
+	int height = 0;
+	uint64_t baseBytes = 0;
+	std::vector<JournalRecord> records;
+};
+
+// stops quietly at the first torn record, false only for a bad header
+bool ReadJournal(const std::string& path, Journal& out, bool headerOnly = false);
+
+struct JournalTileRef {
+	size_t layer;
+	int tileX;
+	int tileY;
+};
+
+// Crash recovery. A pass snapshots the tiles that changed since the last
+// one through readbacks, copying them out a few at a time so it only
+// takes a slice of each frame, then the writer thread deflates them and
+// appends them to the journal as one record.
+class Autosave {
+	struct Capture {
+		JournalTileRef ref;
+		Readback read;
+	};
+
+	std::string path;
+	int width = 0;
+	int height = 0;
+	uint64_t baseBytes = 0;
+
+	std::shared_ptr<JournalRecord> record;
+	std::vector<JournalTileRef> queued;
+	size_t nextQueued = 0;
+	std::deque<Capture> inFlight;
+
+	// writer thread only, journalBytes is how much of it is known good
+	bool hasHeader = false;
+	uint64_t journalBytes = 0;
+	ThreadPool writer{1};
+
+	void cancel();
+	void submit();
+	void append(const std::string& path, int width, int height, uint64_t baseBytes, const JournalRecord& record);
+public:
+	Autosave() = default;
+	~Autosave();
+
+	Autosave(const Autosave&) = delete;
+	Autosave& operator=(const Autosave&) = delete;
+
+	// Points at the journal for a canvas. With keepExisting new records go
+	// after what is already there, otherwise the first one starts it over.
+	void Open(const std::string& path, int width, int height, uint64_t baseBytes, bool keepExisting = false);
+
+	// starts a pass, layers carries the metadata of every layer
+	void Begin(std::vector<CanvasFileLayer> layers, std::vector<JournalTileRef> tiles);
+
+	// main thread, once a frame, spends at most budget seconds
+	void Update(const std::deque<Layer>& layers, double budget);
+
+	// The .mc now holds everything, drop the journal and start a new one
+	// on top of it. A pass in flight is thrown away with it.
+	void Discard(uint64_t baseBytes);
+
+	bool Busy() const;
+};
+
+#endif // AUTOSAVE_H
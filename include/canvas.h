@@ -4,72 +4,64 @@
 
 #include <string>
 #include <deque>
+#include <filesystem>
+#include <vector>
 #include "raylib.h"
 #include "events.h"
+#include "gpu.h"
+#include "layer.h"
+#include "history.h"
+#include "stroke_log.h"
+#include "save_worker.h"
+#include "canvas_file.h"
+#include "layer_stream.h"
+#include "autosave.h"
+#include "dirty_tracker.h"
+#include "gpu_compositor.h"
 #include <SDLHandler.h>
 
+// what the window is cleared to, the canvas shows it where it's clear
+#define CANVAS_BACKGROUND DARKGRAY
+// how long a changed tile stays lit with F3
+#define DIRTY_FLASH_SECONDS 0.5
+
 enum MOUSE_STATE {
     HELD,
     IDLE
 };
 
-struct Layer {
-    int width;
-    int height;
-    unsigned char opacity = 255;
-    RenderTexture2D tex;
-	BlendMode blendingMode;
-
-    Layer(int w, int h, bool whiteBackground = false)
-        : width(w), height(h), opacity(255), blendingMode(BLEND_ALPHA)
-    {
-        tex = LoadRenderTexture(w, h);
-		BeginTextureMode(tex);
-		ClearBackground(BLANK);
-		opacity = 255;
-
-		if(whiteBackground){
-			BeginTextureMode(tex);
-			DrawRectangle(0, 0, tex.texture.width, tex.texture.height, WHITE);
-		}
-		EndTextureMode();
-    }
-
-	Layer(const Layer&) = delete;
-	Layer& operator=(const Layer&) = delete;
-
-	Layer(Layer&& other) noexcept
-		: width(other.width),
-		  height(other.height),
-		  opacity(other.opacity),
-		  tex(other.tex),
-		  blendingMode(other.blendingMode)
-	{
-		other.tex = {};
-	}
-
-	Layer& operator=(Layer&& other) noexcept
-	{
-		if (this != &other) {
-			if (tex.id != 0) {
-				UnloadRenderTexture(tex);
-			}
-
-			width = other.width;
-			height = other.height;
-			opacity = other.opacity;
-			tex = other.tex;
-			blendingMode = other.blendingMode;
-			other.tex = {};
-		}
-		return *this;
-	}
-
-    ~Layer() { 
-		if (tex.id != 0) {
-			UnloadRenderTexture(tex);
-		}
-	}
+enum EXPORT_FORMAT {
+	EXPORT_PNG,
+	EXPORT_PNG_FAST,
+	EXPORT_QOI
+};
+
+enum HISTORY_MODE {
+	HISTORY_TILES,
+	HISTORY_STROKES
+};
+
+struct CanvasConfig {
+	bool lazyLoad = false;
+	double autosaveInterval = AUTOSAVE_DEFAULT_INTERVAL;
+	double autosaveBudget = AUTOSAVE_DEFAULT_BUDGET;
+	EXPORT_FORMAT exportFormat = EXPORT_PNG;
+	CANVAS_CODEC tileCodec = CANVAS_CODEC_RUNS_DEFLATE;
+	HISTORY_MODE historyMode = HISTORY_TILES;
+	size_t strokeKeyframeInterval = STROKE_LOG_DEFAULT_INTERVAL;
+	size_t historyBudget = HISTORY_DEFAULT_BUDGET;
+	size_t historySpillBudget = HISTORY_DEFAULT_SPILL_BUDGET;
+	size_t historyVramBudget = HISTORY_DEFAULT_VRAM_BUDGET;
+};
+
+// what the last save or open left on disk, to tell whether the next save
+// can append to it
+struct SavedFileState {
+	bool valid = false;
+	std::string path;
+	size_t layerCount = 0;
+	CanvasFileSpace space;
+	std::filesystem::file_time_type modified;
 };
 
 struct NotifMessage {
@@ -81,13 +73,53 @@ class Canvas {
 private:
 	std::string fileName;
 	std::string droppedFile;
+	// what the confirmation shows of droppedFile, from its summary
+	Texture2D droppedThumbnail = {};
+	std::string droppedInfo;
     std::deque<Layer> layers;
-	std::deque<std::pair<size_t, Image>> undo;
-	std::deque<std::pair<size_t, Image>> redo;
+	History history;
+	StrokeLog strokeLog;
+	HISTORY_MODE historyMode;
 	std::deque<Color> colorQueue;
 	std::deque<NotifMessage> messageQueue;
 
 	EventBus bus;
+	SaveWorker saver;
+	LayerStream stream;
+	Texture2D preview = {};
+	int previewLevel = -1;
+	bool lazyLoad;
+
+	// what changed where since each of its readers last looked, see
+	// DIRTY_CHANNEL for who they are
+	DirtyTracker dirty;
+	SavedFileState savedFile;
+	std::vector<CanvasFileLayer> savingLayers;
+
+	Autosave autosave;
+	std::vector<CanvasFileLayer> journaledLayers;
+	std::string pendingJournal;
+	uint64_t journalBase = 0;
+	double autosaveInterval;
+	double autosaveBudget;
+	double lastAutosave = 0.0;
+
+	EXPORT_FORMAT exportFormat;
+	CANVAS_CODEC tileCodec;
+
+	// The layers under the selected one flattened over the background, and
+	// the run of alpha blended layers at the top premultiplied. A frame
+	// composites those two with the layers between the selection and
+	// aboveFrom in one shader pass. Rebuilt when a layer in their range
+	// changes or the selection moves.
+	GpuCompositor compositor;
+	RenderTexture2D belowCache = {};
+	RenderTexture2D aboveCache = {};
+	size_t aboveFrom = 0;
+	bool belowValid = false;
+	bool aboveValid = false;
+	size_t cachedSelected = (size_t)-1;
+	size_t cachedLayerCount = 0;
 
     MOUSE_STATE mouseState;
     Vector2 prevMousePos = {-1, -1};
@@ -98,7 +130,8 @@ private:
 	Rectangle colorPickerBounds;
 	Rectangle canvasDimensions;
 	float rotation = 0.0f;
-	Image currentLayerCache;
+	Image currentLayerCache = {};
+	Readback colorPickRead;
     int width;
     int height;
     float brushSize;
@@ -111,6 +144,9 @@ private:
 	bool isMirror;
 	bool isColorPicking = true;
 	bool isUiHidden = false;
+	bool showDirty = false;
+	// per file tile, when the overlay last saw it change
+	std::vector<double> dirtyFlash;
 	bool isSaved = false;
 
     Color clr;
@@ -118,13 +154,21 @@ private:
 	unsigned char transparency;
     size_t selectedLayer;
 public:
-    Canvas(int width, int height, size_t maxLayers, std::string fileName);
+    Canvas(int width, int height, size_t maxLayers, std::string fileName, CanvasConfig config = CanvasConfig{});
 	Canvas() {}
 	Canvas(const Canvas&) = delete;
 	Canvas& operator=(const Canvas&) = delete;
 
     void Update();
     void Render();
+
+	// blocks until a save in flight is written, call before closing the window
+	void FinishSaving();
+
+	// Seconds until the canvas wants another frame without any input, 0
+	// while something's still in flight (a save, layers streaming in,
+	// readbacks, autosave work, a fading overlay), infinity if never.
+	double IdleTimeout();
 private:
 	Color pick_color(Vector2 pos);
 	Vector2 screen_to_canvas(Vector2 pos);
@@ -133,16 +177,42 @@ private:
     void create_layer(bool whiteBackground = false);
     void draw_circle(Vector2 pos);
     void draw_line(Vector2 v1, Vector2 v2);
+	bool undo();
+	bool redo();
 
 	// startup
 	void handle_file_loading();
 	void handle_window();
 	bool load(std::string fileName);
+	bool open_stream(std::string fileName);
+	void show_preview(const unsigned char* pixels, int w, int h, int level);
+	void drop_preview();
+	void load_dropped_summary();
+	void unload_dropped_summary();
+	void upload_layer(size_t index, bool ok, const std::vector<unsigned char>& pixels);
+	void finish_stream();
+	void materialize_layer(size_t index);
+	void materialize_all();
+	void stream_layers();
 
 	// misc
 	void handle_dropped_files();
-	void save_to_png();
-	void save();
+	void save(bool exportPng = false);
+	void update_saving();
+	void report_save(const SaveResult& result);
+	void remember_saved(const std::string& path, size_t layerCount, const CanvasFileSpace& space);
+	bool can_append();
+	void mark_dirty(size_t layer, int x, int y, int w, int h);
+	void mark_layer_dirty(size_t layer);
+	void reset_dirty();
+	std::vector<CanvasFileLayer> layer_meta();
+
+	// autosave
+	std::string journal_path();
+	void check_journal(bool loaded);
+	void replay_journal();
+	void update_autosave();
+	Readback read_composite(DirtyRect region);
 
 	// Update Stuff
 	bool penPressedThisFrame = false;
@@ -157,7 +227,10 @@ private:
 	bool handle_tool_input();
 
 	// Rendering Stuff
+	void invalidate_composites();
+	void update_composites();
 	void render_layers();
+	void render_dirty_overlay();
 	void render_color_picker();
 	void render_layer_ui();
 };
@@ -0,0 +1,159 @@
+#pragma once
+#ifndef CANVAS_FILE_H
+#define CANVAS_FILE_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "raylib.h"
+#include "tile_codec.h"
+
+#define CANVAS_FILE_MAGIC "MYCV"
+#define CANVAS_FILE_VERSION 6
+#define CANVAS_FILE_TILE_SIZE 256
+#define CANVAS_FILE_PREVIEW_LEVELS 3
+#define CANVAS_FILE_SUMMARY_SIZE 16384
+#define CANVAS_FILE_THUMBNAIL_SIZE 128
+
+// .mc v6 layout, all integers little endian:
+//
+//   header   magic[4] version:u32 indexOffset:u64
+//   summary  CANVAS_FILE_SUMMARY_SIZE bytes, zero padded
+//            size:u32 checksum:u32 (FNV-1a of the next size bytes)
+//            width:u32 height:u32 layerCount:u32 listedLayers:u32
+//            thumbWidth:u32 thumbHeight:u32 thumbSize:u32
+//            listedLayers * (opacity:u8 pad[3] blendMode:i32)
+//            thumbSize bytes of deflated RGBA, image row order
+//   blobs    previews (deflated) and tiles (see tile_codec.h), in any order
+//   index    width:u32 height:u32 tileSize:u32 layerCount:u32 colorCount:u32
+//            previewCount:u32 entryCount:u32
+//            colorCount * (r g b)
+//            layerCount * (opacity:u8 pad[3] blendMode:i32)
+//            previewCount * (width:u32 height:u32 offset:u64 size:u32)
+//            entryCount * (layer:u32 tileX:u32 tileY:u32 offset:u64 size:u32 codec:u8 pad[3])
+//
+// The summary sits at a fixed spot so anything that only wants to show
+// the file reads the first few KB and stops. The thumbnail fits within
+// CANVAS_FILE_THUMBNAIL_SIZE on its long side, and is made smaller (or
+// left out) along with the layer list if they don't fit the block.
+//
+// Tiles that are entirely zero are not stored and load back as zero.
+// Previews are the flattened image at 1/4, 1/16 and 1/64 of the area,
+// finest first.
+//
+// A full save writes previews, tiles and index in that order. An
+// appended save leaves everything in place and adds the tiles that
+// changed plus a new index after the old end of file, then repoints
+// indexOffset. Until that last 8-byte write the old index is still the
+// live one, so a crash mid-append loses the append and nothing else.
+// The summary is then rewritten in place; a torn one fails its checksum
+// and readers fall back to the index.
+// What the index no longer references is dead space until the next
+// full save compacts it.
+//
+// v5 is the same without the summary, and v4 without the codec either,
+// every tile deflated. Both are read but never appended to, the first
+// save after opening one rewrites it as v6.
+// v3 and v2 (header with a fixed layer table and a toc at the end) and
+// v1 (plain text header, one blob per layer) are still read.
+
+struct CanvasFileLayer {
+	unsigned char opacity = 255;
+	int blendMode = BLEND_ALPHA;
+	std::vector<unsigned char> pixels;  // width*height RGBA, texture row order
+	// per tile, row major, for appends: set tiles get rewritten. Empty
+	// means every tile. A layer with no pixels is left as it is.
+	std::vector<unsigned char> dirty;
+};
+
+// unlike layers, previews are in image row order (top row first)
+struct CanvasFilePreview {
+	int width = 0;
+	int height = 0;
+	std::vector<unsigned char> pixels;
+};
+
+struct CanvasFileData {
+	int width = 0;
+	int height = 0;
+	std::deque<Color> colors;
+	std::vector<CanvasFileLayer> layers;
+	std::vector<CanvasFilePreview> previews;  // finest first
+	int codec = CANVAS_CODEC_DEFLATE;         // for the tiles a save writes
+};
+
+// where one stored tile lives in the file
+struct CanvasFileTile {
+	uint32_t layer;
+	uint32_t tileX;
+	uint32_t tileY;
+	uint64_t offset;
+	uint32_t size;
+	uint8_t codec = CANVAS_CODEC_DEFLATE;
+};
+
+// Everything but the pixels: enough to build the layer list and decode
+// layers one at a time later. tileSize is 0 for v1, where each layer is
+// a single blob.
+struct CanvasFileIndex {
+	int version = 0;
+	int width = 0;
+	int height = 0;
+	int tileSize = 0;
+	std::deque<Color> colors;
+	std::vector<CanvasFileLayer> layers;             // pixels left empty
+	std::vector<std::vector<CanvasFileTile>> tiles;  // per layer
+	std::vector<CanvasFileTile> previews;            // tileX/tileY hold the level size
+	uint64_t liveBytes = 0;                          // v4+, bytes the index still references
+};
+
+// what the summary block holds
+struct CanvasFileSummary {
+	int width = 0;
+	int height = 0;
+	size_t layerCount = 0;
+	std::vector<CanvasFileLayer> layers;  // pixels left empty, may stop short of layerCount
+	CanvasFilePreview thumbnail;          // empty if the file has none
+};
+
+struct CanvasFileSpace {
+	uint64_t fileBytes = 0;
+	uint64_t liveBytes = 0;
+};
+
+bool ReadCanvasFileIndex(const unsigned char* data, size_t size, CanvasFileIndex& out);
+
+// from the start of a v6 file, at least 16 + CANVAS_FILE_SUMMARY_SIZE
+// bytes of it or the whole file if shorter. False for older versions.
+bool ParseCanvasFileSummary(const unsigned char* data, size_t size, CanvasFileSummary& out);
+// reads just the header and summary off disk
+bool ReadCanvasFileSummary(const std::string& path, CanvasFileSummary& out);
+bool DecodeCanvasLayer(const unsigned char* data, const CanvasFileIndex& index, size_t layer, std::vector<unsigned char>& pixels);
+bool DecodeCanvasPreview(const unsigned char* data, const CanvasFileIndex& index, size_t level, CanvasFilePreview& out);
+
+// box filters an image-order RGBA composite down into the preview levels
+void BuildCanvasPreviews(const unsigned char* pixels, int width, int height, std::vector<CanvasFilePreview>& out);
+// Redoes the part of previews (built for a width x height image) under the
+// image-order region x,y,w,h, with pixels holding just that region. x and
+// y have to be multiples of 1 << CANVAS_FILE_PREVIEW_LEVELS, and so do
+// the far edges unless they're the image's. False if the sizes don't match.
+bool UpdateCanvasPreviews(const unsigned char* pixels, int x, int y, int w, int h,
+		int width, int height, std::vector<CanvasFilePreview>& previews);
+
+bool LoadCanvasFile(const std::string& path, CanvasFileData& out);
+
+// Writes to <path>.tmp and renames it over path once complete, so a
+// failed or interrupted save leaves the old file alone. progress gets
+// the fraction of tiles written so far, from whatever thread is saving.
+bool SaveCanvasFile(const std::string& path, const CanvasFileData& data,
+		const std::function<void(float)>& progress = nullptr, CanvasFileSpace* space = nullptr);
+
+// Appends changed tiles to an existing v6 file in place, see above. Fails
+// without touching the file if it isn't one this data can extend.
+bool AppendCanvasFile(const std::string& path, const CanvasFileData& data,
+		const std::function<void(float)>& progress = nullptr, CanvasFileSpace* space = nullptr);
+
+#endif // CANVAS_FILE_H
@@ -0,0 +1,56 @@
+#pragma once
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <vector>
+
+// How a layer goes onto what's below it, stored as is in .mc files. The
+// first three have the values of raylib's BlendMode of the same name and
+// plain GL blending can do them, the rest need the compositing shader
+// (see GpuCompositor) or the CPU.
+enum LAYER_BLEND {
+	LAYER_BLEND_ALPHA,
+	LAYER_BLEND_ADDITIVE,
+	LAYER_BLEND_MULTIPLIED,
+	LAYER_BLEND_SCREEN,
+	LAYER_BLEND_OVERLAY,
+	LAYER_BLEND_DARKEN,
+	LAYER_BLEND_COUNT
+};
+
+enum COMPOSITE_KERNEL {
+	COMPOSITE_SCALAR,
+	COMPOSITE_SSE2,
+	COMPOSITE_AVX2
+};
+
+// one layer to flatten, width*height RGBA in whatever row order the
+// others use. blendMode is a LAYER_BLEND, anything past those is treated
+// as LAYER_BLEND_ALPHA.
+struct CompositeLayer {
+	const unsigned char* pixels;
+	unsigned char opacity;
+	int blendMode;
+};
+
+// CPU version of what render_layers() draws: layers bottom first over a
+// transparent background, with the same blend equations as the
+// compositing shader, in 8-bit fixed point. The scaled alpha is rounded
+// to 8 bits where the GPU keeps it as a float, so results drift up to
+// about 3 steps per channel from the GPU over a few layers. Rows are
+// split into bands across SharedPool(). flipRows writes the output
+// upside down, which turns texture row order into image row order.
+void CompositeLayers(const std::vector<CompositeLayer>& layers, int width, int height, unsigned char* out, bool flipRows = false);
+
+// what a blendMode read from a file is drawn as
+LAYER_BLEND ValidLayerBlend(int mode);
+// short lowercase name, "?" for anything out of range
+const char* LayerBlendName(int mode);
+
+// picked once from what the CPU supports, forcing one is for comparing
+// (mycanvas-cli bench-composite)
+COMPOSITE_KERNEL CompositeKernel();
+void ForceCompositeKernel(COMPOSITE_KERNEL kernel);
+const char* CompositeKernelName(COMPOSITE_KERNEL kernel);
+
+#endif // COMPOSITOR_H
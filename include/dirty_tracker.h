@@ -0,0 +1,73 @@
+#pragma once
+#ifndef DIRTY_TRACKER_H
+#define DIRTY_TRACKER_H
+
+#include <cstddef>
+#include <vector>
+
+// Everything that reads the changed regions, each with its own copy so
+// one catching up doesn't hide a change from the others.
+enum DIRTY_CHANNEL {
+	DIRTY_SAVE,       // tiles the next appended save writes
+	DIRTY_JOURNAL,    // tiles the next autosave pass writes
+	DIRTY_COMPOSITE,  // what the below/above caches haven't redrawn
+	DIRTY_PREVIEW,    // what the previews of the last save don't show
+	DIRTY_OVERLAY,    // what the debug overlay flashes next
+	DIRTY_CHANNEL_COUNT
+};
+
+#define DIRTY_ALL ((1u << DIRTY_CHANNEL_COUNT) - 1)
+#define DIRTY_BIT(channel) (1u << (channel))
+
+// in texture space, like the layers
+struct DirtyRect {
+	int x = 0;
+	int y = 0;
+	int w = 0;
+	int h = 0;
+
+	bool Empty() const { return w <= 0 || h <= 0; }
+};
+
+// Changed pixels per layer, as one flag per CANVAS_FILE_TILE_SIZE tile
+// (what saves and autosaves write) plus the exact bounding box of every
+// mark (what the caches redraw). Layers are added as they're marked.
+class DirtyTracker {
+	struct Channel {
+		std::vector<std::vector<unsigned char>> tiles;  // per layer, empty if clean
+		std::vector<DirtyRect> bounds;                   // per layer
+	};
+
+	int width = 0;
+	int height = 0;
+	int tilesX = 0;
+	int tilesY = 0;
+	Channel channels[DIRTY_CHANNEL_COUNT];
+
+	static const std::vector<unsigned char> clean;
+public:
+	// drops every mark, for a canvas of this size
+	void Reset(int width, int height);
+
+	// channels is a mask of DIRTY_BIT()s
+	void Mark(size_t layer, int x, int y, int w, int h, unsigned channels = DIRTY_ALL);
+	void MarkLayer(size_t layer, unsigned channels = DIRTY_ALL);
+
+	bool Any(DIRTY_CHANNEL channel, size_t layer) const;
+	// one flag per tile, row major, empty when the layer is clean
+	const std::vector<unsigned char>& Tiles(DIRTY_CHANNEL channel, size_t layer) const;
+	// union of the marks on layers [from, to)
+	DirtyRect Bounds(DIRTY_CHANNEL channel, size_t from, size_t to) const;
+	// dirty tiles over every layer
+	size_t Count(DIRTY_CHANNEL channel) const;
+
+	void Clear(DIRTY_CHANNEL channel);
+	void ClearLayer(DIRTY_CHANNEL channel, size_t layer);
+	// from's marks replace to's
+	void Copy(DIRTY_CHANNEL from, DIRTY_CHANNEL to);
+
+	int TilesX() const;
+	int TilesY() const;
+};
+
+#endif // DIRTY_TRACKER_H
@@ -0,0 +1,68 @@
+#pragma once
+#ifndef GPU_H
+#define GPU_H
+
+#include <cstdint>
+#include <vector>
+#include "raylib.h"
+
+// Regions here are in texture space: GL row order, so row 0 is the
+// bottom row of the canvas. Pixels are tightly packed RGBA8.
+
+// Asynchronous readback. The copy is queued into a pixel buffer object
+// and fenced, so creating one never stalls; the pixels are mapped once
+// the GPU is done with them, usually a frame or two later. Draws issued
+// after the request don't affect what it returns. Without PBO support
+// the read happens synchronously and the object is ready immediately.
+class Readback {
+	unsigned int pbo = 0;
+	void* fence = nullptr;
+	int width = 0;
+	int height = 0;
+	bool pending = false;
+	std::vector<unsigned char> data;
+
+	void release();
+public:
+	Readback() = default;
+	Readback(const RenderTexture2D& target);
+	Readback(const RenderTexture2D& target, int x, int y, int w, int h);
+	~Readback();
+
+	Readback(const Readback&) = delete;
+	Readback& operator=(const Readback&) = delete;
+	Readback(Readback&& other) noexcept;
+	Readback& operator=(Readback&& other) noexcept;
+
+	bool Valid() const;
+	bool Ready();
+
+	// block until the pixels are there and copy them out; the readback is
+	// spent afterwards
+	bool Resolve(unsigned char* out);
+	Image ResolveImage();
+
+	int Width() const;
+	int Height() const;
+};
+
+void WriteTextureRegion(const RenderTexture2D& target, int x, int y, int w, int h, const unsigned char* pixels);
+
+// GPU side copy between two render targets, no readback involved
+void BlitTextureRegion(const RenderTexture2D& src, int sx, int sy, const RenderTexture2D& dst, int dx, int dy, int w, int h);
+
+// texture units a fragment shader can sample from, 0 if GL won't say
+int MaxTextureUnits();
+
+// GL_TIMESTAMP queries, for timing stretches of GPU work without stalling.
+// A stamp flushes raylib's batch and is read back once the GPU has gone
+// past it, usually a frame or two later. Needs GL 3.3, GpuTimestamp()
+// returns 0 everywhere else.
+bool GpuTimestampsSupported();
+unsigned int GpuTimestamp();
+// false until it's there, then the GPU clock at the stamp in nanoseconds
+bool ReadGpuTimestamp(unsigned int query, uint64_t* ns);
+// the query goes back in the pool, read or not
+void ReleaseGpuTimestamp(unsigned int query);
+
+#endif // GPU_H
@@ -0,0 +1,79 @@
+#pragma once
+#ifndef GPU_COMPOSITOR_H
+#define GPU_COMPOSITOR_H
+
+#include <cstddef>
+
+#include "compositor.h"
+#include "dirty_tracker.h"
+#include "raylib.h"
+
+// a texture that holds premultiplied color already, like the cache of the
+// alpha layers over the selection, goes on with GL_ONE, GL_ONE_MINUS_SRC_ALPHA
+#define GPU_BLEND_PREMULTIPLIED LAYER_BLEND_COUNT
+
+// most layers one shader pass samples, past what the GPU has it's less
+#define GPU_COMPOSITE_MAX_UNITS 16
+
+struct GpuLayer {
+	Texture2D texture;
+	unsigned char opacity;
+	int blendMode;  // a LAYER_BLEND or GPU_BLEND_PREMULTIPLIED
+};
+
+// Flattens layers with one fragment shader that samples up to Units() of
+// them at once and blends them in registers, with the equations of
+// CompositeLayers(). That's a draw and a blend state per Units() layers
+// instead of per layer, and it's the only way the modes past
+// LAYER_BLEND_MULTIPLIED get drawn. Without shaders every layer is drawn
+// in turn with GL blending, where those come out as LAYER_BLEND_ALPHA.
+//
+// Every texture is sampled at the same coordinates, so they all have to
+// be the canvas' size. Regions are in texture space.
+class GpuCompositor {
+	Shader shader = {};
+	bool tried = false;
+	size_t units = 0;
+	int hasBaseLoc = -1;
+	int backgroundLoc = -1;
+	int countLoc = -1;
+	int opacityLoc = -1;
+	int modeLoc = -1;
+
+	// [0] is where Flatten() goes without a target, [1] the other half of
+	// every multi-pass flatten
+	RenderTexture2D scratch[2] = {};
+
+	void load();
+	RenderTexture2D& scratch_target(int i, int width, int height);
+	void pass(const Texture2D* base, Color background, const GpuLayer* layers, size_t count,
+			Rectangle source, Rectangle dest, Vector2 origin, float rotation);
+	void fixed_function(const Texture2D* base, Color background, const GpuLayer* layers, size_t count,
+			Rectangle source, Rectangle dest, Vector2 origin, float rotation);
+public:
+	GpuCompositor() = default;
+	~GpuCompositor();
+
+	GpuCompositor(const GpuCompositor&) = delete;
+	GpuCompositor& operator=(const GpuCompositor&) = delete;
+
+	// layers per pass, 0 without shaders. Loads the shader the first time.
+	size_t Units();
+
+	// Draws layers over base, or over background without one, into
+	// whatever is being drawn to, replacing what's there. source, dest,
+	// origin and rotation go to DrawTexturePro(). Anything over Units()
+	// is flattened into a scratch texture first.
+	void Draw(const Texture2D* base, Color background, const GpuLayer* layers, size_t count,
+			Rectangle source, Rectangle dest, Vector2 origin, float rotation);
+
+	// Same, but into target at its own orientation, only under region and
+	// in as many passes as Units() takes.
+	void Flatten(const Texture2D* base, Color background, const GpuLayer* layers, size_t count,
+			RenderTexture2D& target, DirtyRect region);
+	// into a width x height scratch texture, good until the next call
+	const Texture2D& Flatten(const Texture2D* base, Color background, const GpuLayer* layers, size_t count,
+			int width, int height, DirtyRect region);
+};
+
+#endif // GPU_COMPOSITOR_H
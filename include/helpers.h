@@ -9,5 +9,6 @@ void DrawTextContrast(const char *text, int posX, int posY, int fontSize, Color
 bool contains(const std::deque<Color>& d, Color value);
 float AngleFromScreenCenter(Vector2 pos);
 float NormalizeAngleDelta(float delta);
+void DrawStrokeSegment(const RenderTexture2D& target, Vector2 from, Vector2 to, float radius, Color color, bool isBrush);
 
 #endif // HELPERS_H
@@ -0,0 +1,172 @@
+#pragma once
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "gpu.h"
+#include "layer.h"
+#include "scratch_file.h"
+#include "thread_pool.h"
+
+#define HISTORY_TILE_SIZE 128
+#define HISTORY_DEFAULT_BUDGET ((size_t)256 << 20)
+#define HISTORY_DEFAULT_SPILL_BUDGET ((size_t)4096 << 20)
+#define HISTORY_DEFAULT_VRAM_BUDGET ((size_t)256 << 20)
+#define HISTORY_POOL_PAGE_SIZE 2048
+
+// one tile of a layer, x/y/w/h in texture space (see gpu.h)
+struct HistoryTile {
+	int x, y, w, h;
+};
+
+// Render target pages cut into tile sized slots. Strokes captured here are
+// copied GPU side with framebuffer blits, so pen-down never waits on a
+// readback. One slot is kept aside as the temporary for swaps.
+class TilePool {
+	std::vector<RenderTexture2D> pages;
+	std::vector<int> freeSlots;
+	size_t maxPages;
+	int swapSlot = -1;
+	size_t usedSlots = 0;
+
+	bool grow();
+	void slot_rect(int slot, const RenderTexture2D** page, int* x, int* y) const;
+public:
+	TilePool(size_t budget);
+	~TilePool();
+
+	TilePool(const TilePool&) = delete;
+	TilePool& operator=(const TilePool&) = delete;
+
+	// false with no budget, or on GL 2.1 / ES 2 where tiles can't be blitted
+	bool Enabled() const;
+	int Allocate();
+	void Free(int slot);
+
+	void Store(int slot, const RenderTexture2D& layer, const HistoryTile& tile);
+	void Swap(int slot, const RenderTexture2D& layer, const HistoryTile& tile);
+	Readback Read(int slot, const HistoryTile& tile) const;
+
+	size_t Capacity() const;
+	size_t FreeSlots() const;
+	size_t UsedBytes() const;
+};
+
+// an in-flight readback landing at `offset` in an entry's pixels
+struct PendingRead {
+	size_t offset;
+	Readback read;
+};
+
+// Tile pixels sit back to back in `pixels` while the entry is fresh. They
+// arrive through async readbacks, so the entry "settles" a frame or two
+// after capture. The compressor thread deflates them into `packed` and
+// frees the raw copy; they are inflated again only when the entry is
+// stepped through. Old entries past the RAM budget move their packed
+// bytes to the scratch file.
+// Entries kept on the GPU instead have one pool slot per tile and never
+// touch the CPU side until they are demoted.
+struct HistoryEntry {
+	size_t layer = 0;
+	size_t rawBytes = 0;
+	size_t heldBytes = 0;
+	bool dropped = false;
+	bool onGpu = false;
+	bool spilled = false;
+	bool spillQueued = false;
+	uint64_t spillOffset = 0;
+	size_t spillSize = 0;
+	std::vector<HistoryTile> tiles;
+	std::vector<int> slots;
+	std::vector<PendingRead> reads;
+	std::vector<unsigned char> pixels;
+	std::vector<unsigned char> packed;
+	std::mutex lock;
+};
+
+struct HistoryStats {
+	size_t depth;
+	size_t redoDepth;
+	size_t heldBytes;
+	size_t rawBytes;
+	size_t spilledBytes;
+	size_t vramBytes;
+};
+
+// Undo/redo built from per-stroke tile deltas. A stroke only keeps the
+// tiles it actually touched, with their contents from before the stroke,
+// and the oldest strokes are dropped once the memory budget is used up.
+class History {
+	typedef std::shared_ptr<HistoryEntry> EntryPtr;
+
+	std::deque<EntryPtr> undo;
+	std::deque<EntryPtr> redo;
+	std::vector<EntryPtr> settling;
+
+	EntryPtr pending;
+	std::vector<bool> captured;
+	int tilesX = 0;
+	int tilesY = 0;
+
+	size_t budget;
+	size_t spillBudget;
+	size_t rawBytes = 0;
+	std::atomic<size_t> heldBytes{0};
+	std::atomic<size_t> spilledBytes{0};
+
+	TilePool pool;
+	ScratchFile scratch;
+	ThreadPool compressor{1};
+
+	void trim();
+	void drop(const EntryPtr& entry);
+	void demote(HistoryEntry& entry);
+	void settle(HistoryEntry& entry);
+	void release(HistoryEntry& entry);
+	bool pack(HistoryEntry& entry);
+	bool unpack(HistoryEntry& entry);
+	void compress(const EntryPtr& entry);
+	void spill(const EntryPtr& entry);
+	bool restore(std::deque<EntryPtr>& from, std::deque<EntryPtr>& to, std::deque<Layer>& layers);
+public:
+	// spillBudget caps the scratch file, 0 keeps everything in RAM.
+	// vramBudget sizes the GPU tile pool, 0 captures straight to the CPU.
+	History(size_t budget = HISTORY_DEFAULT_BUDGET,
+			size_t spillBudget = HISTORY_DEFAULT_SPILL_BUDGET,
+			size_t vramBudget = HISTORY_DEFAULT_VRAM_BUDGET);
+	~History();
+
+	History(const History&) = delete;
+	History& operator=(const History&) = delete;
+
+	void BeginStroke(const Layer& layer, size_t layerIndex);
+	void CaptureRegion(const Layer& layer, int x, int y, int w, int h);
+	void EndStroke();
+
+	// finishes captures whose readbacks have landed, call once per frame
+	void Update();
+	// captures still waiting on the GPU, Update() has work while true
+	bool Settling() const;
+
+	bool Undo(std::deque<Layer>& layers);
+	bool Redo(std::deque<Layer>& layers);
+
+	void SwapLayers(size_t a, size_t b);
+	void ClearRedo();
+	void Clear();
+
+	size_t Depth() const;
+	size_t UsedBytes() const;
+	HistoryStats Stats() const;
+
+	// called for every tile an undo or redo writes back
+	LayerRegionFn onRestore;
+};
+
+#endif // HISTORY_H
@@ -0,0 +1,25 @@
+#pragma once
+#ifndef IMAGE_EXPORT_H
+#define IMAGE_EXPORT_H
+
+#include <string>
+
+enum PNG_LEVEL {
+	PNG_STORED,   // no compression at all, just framing
+	PNG_FAST,     // Sub filter, short match search
+	PNG_DEFAULT   // per row filter choice, deeper match search
+};
+
+// Writes RGBA pixels (top row first) as a PNG. The image is cut into row
+// stripes that are filtered and deflated in parallel on SharedPool(), each
+// stripe byte aligned with a sync flush like pigz does, and stitched into
+// one zlib stream, so any decoder reads it as a normal PNG. A stripe can
+// still match against the 32K before it. Codes are deflate's fixed
+// Huffman ones, same as raylib's own PNG writer.
+bool WritePng(const std::string& path, const unsigned char* pixels, int width, int height, PNG_LEVEL level = PNG_DEFAULT);
+
+// picks by extension: .png goes through WritePng, anything else (.qoi is
+// the quick one) through raylib's ExportImage
+bool ExportPixels(const std::string& path, const unsigned char* pixels, int width, int height, PNG_LEVEL level = PNG_DEFAULT);
+
+#endif // IMAGE_EXPORT_H
@@ -0,0 +1,84 @@
+#pragma once
+#ifndef LAYER_H
+#define LAYER_H
+
+#include <cstddef>
+#include <functional>
+
+#include "compositor.h"
+#include "raylib.h"
+
+// pixels of layers[layer] changed under x/y/w/h, in texture space
+typedef std::function<void(size_t layer, int x, int y, int w, int h)> LayerRegionFn;
+
+struct Layer {
+    int width;
+    int height;
+    unsigned char opacity = 255;
+    RenderTexture2D tex = {};
+	LAYER_BLEND blendingMode;
+	// layer index in the file it was opened from while its pixels are
+	// still only there, -1 once the texture is resident
+	int source = -1;
+
+    Layer(int w, int h, bool whiteBackground = false, bool deferred = false)
+        : width(w), height(h), opacity(255), blendingMode(LAYER_BLEND_ALPHA)
+    {
+		if (!deferred)
+			Allocate(whiteBackground);
+    }
+
+	void Allocate(bool whiteBackground = false) {
+        tex = LoadRenderTexture(width, height);
+		BeginTextureMode(tex);
+		ClearBackground(BLANK);
+
+		if(whiteBackground){
+			BeginTextureMode(tex);
+			DrawRectangle(0, 0, tex.texture.width, tex.texture.height, WHITE);
+		}
+		EndTextureMode();
+	}
+
+	bool Resident() const { return tex.id != 0; }
+
+	Layer(const Layer&) = delete;
+	Layer& operator=(const Layer&) = delete;
+
+	Layer(Layer&& other) noexcept
+		: width(other.width),
+		  height(other.height),
+		  opacity(other.opacity),
+		  tex(other.tex),
+		  blendingMode(other.blendingMode),
+		  source(other.source)
+	{
+		other.tex = {};
+	}
+
+	Layer& operator=(Layer&& other) noexcept
+	{
+		if (this != &other) {
+			if (tex.id != 0) {
+				UnloadRenderTexture(tex);
+			}
+
+			width = other.width;
+			height = other.height;
+			opacity = other.opacity;
+			tex = other.tex;
+			blendingMode = other.blendingMode;
+			source = other.source;
+			other.tex = {};
+		}
+		return *this;
+	}
+
+    ~Layer() { 
+		if (tex.id != 0) {
+			UnloadRenderTexture(tex);
+		}
+	}
+};
+
+#endif // LAYER_H
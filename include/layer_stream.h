@@ -0,0 +1,63 @@
+#pragma once
+#ifndef LAYER_STREAM_H
+#define LAYER_STREAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "canvas_file.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+
+struct StreamedItem {
+	bool isPreview = false;
+	size_t index = 0;    // layer in the file, or preview level
+	bool ok = false;
+	int width = 0;
+	int height = 0;
+	std::vector<unsigned char> pixels;
+};
+
+// A mapped .mc file being opened in the background. Requests decode in
+// the order they're made on a loader thread (which fans each layer out
+// over the shared pool); finished pixels are picked up with Poll() on
+// the main thread, which owns the GPU uploads.
+class LayerStream {
+	MappedFile file;
+	CanvasFileIndex index;
+
+	std::mutex lock;
+	std::deque<StreamedItem> ready;
+	std::atomic<bool> cancelled{false};
+
+	ThreadPool loader{1};
+
+	void finish(StreamedItem item);
+public:
+	LayerStream() = default;
+	~LayerStream();
+
+	LayerStream(const LayerStream&) = delete;
+	LayerStream& operator=(const LayerStream&) = delete;
+
+	bool Open(const std::string& path);
+	// drops pending requests and unmaps the file
+	void Close();
+
+	bool IsOpen() const;
+	const CanvasFileIndex& Index() const;
+
+	// decode right now on the calling thread
+	bool DecodeLayer(size_t layer, std::vector<unsigned char>& pixels);
+	bool DecodePreview(size_t level, CanvasFilePreview& out);
+
+	void RequestLayer(size_t layer);
+	void RequestPreview(size_t level);
+	bool Poll(StreamedItem& out);
+};
+
+#endif // LAYER_STREAM_H
@@ -0,0 +1,33 @@
+#pragma once
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only view of a whole file. Pages are faulted in as they're
+// touched, so opening a big file costs next to nothing until its bytes
+// are actually needed.
+class MappedFile {
+#if defined(_WIN32)
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::string& path);
+	void Close();
+
+	bool IsOpen() const;
+	const unsigned char* Data() const;
+	size_t Size() const;
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,100 @@
+#pragma once
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// What a frame gets split into. Phases can nest (a readback in the middle
+// of a key handler counts to both) and can run more than once a frame, the
+// times add up.
+enum PROFILE_PHASE {
+	PROFILE_FRAME,         // loop start to after EndDrawing(), without idle waits
+	PROFILE_INPUT,         // PumpSDLTabletInput()
+	PROFILE_KEYS,          // handle_key_events()
+	PROFILE_TOOLS,         // handle_tool_input()
+	PROFILE_LAYERS,        // render_layers()
+	PROFILE_COLOR_PICKER,  // render_color_picker()
+	PROFILE_LAYER_UI,      // render_layer_ui()
+	PROFILE_TRANSFERS,     // readbacks and texture uploads
+	PROFILE_PHASE_COUNT
+};
+
+// frames kept for the graph and the percentiles
+#define PROFILE_HISTORY 240
+// frames of GPU stamps that may still be in flight before the oldest is dropped
+#define PROFILE_GPU_LATENCY 8
+
+const char* ProfilePhaseName(int phase);
+
+// Per phase CPU time for every frame, and GPU time from timestamp queries
+// while the overlay is up (the stamps flush raylib's batch, which changes
+// what's being measured a little, so they stay off otherwise). Main
+// thread only, same as GL.
+class Profiler {
+	typedef std::chrono::steady_clock Clock;
+
+	struct Span {
+		int phase;
+		unsigned int begin;
+		unsigned int end;
+	};
+	struct InFlight {
+		size_t frame;
+		std::vector<Span> spans;
+	};
+	struct Frame {
+		float cpu[PROFILE_PHASE_COUNT];  // ms
+		float gpu[PROFILE_PHASE_COUNT];  // ms, negative until known
+	};
+
+	Clock::time_point started[PROFILE_PHASE_COUNT];
+	unsigned int stamped[PROFILE_PHASE_COUNT] = {};
+	int depth[PROFILE_PHASE_COUNT] = {};
+	double cpu[PROFILE_PHASE_COUNT] = {};
+
+	std::vector<Span> spans;
+	std::deque<InFlight> inFlight;
+	std::vector<Frame> history;
+	size_t frames = 0;
+	bool visible = false;
+	bool gpuTiming = false;
+
+	void collect();
+	void drop(InFlight& f);
+	void percentiles(int phase, bool gpu, float out[3]) const;
+public:
+	Profiler();
+
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+
+	void BeginFrame();
+	void EndFrame();
+	void Begin(int phase);
+	void End(int phase);
+
+	bool Visible() const;
+	void SetVisible(bool visible);
+
+	// the phase table with p50/p95/p99 and a graph of the last
+	// PROFILE_HISTORY frames, in the bottom right corner (notifications
+	// have the top)
+	void Draw() const;
+};
+
+Profiler& SharedProfiler();
+
+struct ProfileScope {
+	int phase;
+	ProfileScope(int phase) : phase(phase) { SharedProfiler().Begin(phase); }
+	~ProfileScope() { SharedProfiler().End(phase); }
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+#endif // PROFILER_H
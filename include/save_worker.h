@@ -0,0 +1,98 @@
+#pragma once
+#ifndef SAVE_WORKER_H
+#define SAVE_WORKER_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "canvas_file.h"
+#include "dirty_tracker.h"
+#include "gpu.h"
+#include "image_export.h"
+#include "raylib.h"
+#include "thread_pool.h"
+
+struct SaveResult {
+	bool ok;
+	bool exportedPng;
+	bool appended;
+	std::string path;
+	std::string pngPath;
+	size_t layerCount;
+	CanvasFileSpace space;
+};
+
+// Saves off the render thread. Start() takes readbacks queued at the
+// moment of the save, which pins the pixels as they were then no matter
+// what gets painted afterwards. Poll() copies them out as the GPU
+// delivers them and then hands everything to a writer thread.
+class SaveWorker {
+	struct Job {
+		std::string path;
+		std::string pngPath;
+		CanvasFileData data;
+		std::vector<Readback> reads;
+		Readback compositeRead;
+		DirtyRect compositeRegion;
+		bool append = false;
+		PNG_LEVEL pngLevel = PNG_DEFAULT;
+		Image composite = {};
+		size_t resolved = 0;
+	};
+
+	std::shared_ptr<Job> job;
+	bool writing = false;
+	std::atomic<float> progress{0.0f};
+
+	std::mutex lock;
+	bool finished = false;
+	SaveResult result;
+
+	ThreadPool writer{1};
+
+	// what the last save to previewsPath put in the file, only touched
+	// by the writer while a save is running
+	std::vector<CanvasFilePreview> previews;
+	std::string previewsPath;
+
+	void submit();
+	static void flatten(const CanvasFileData& data, Image& out);
+public:
+	SaveWorker() = default;
+	~SaveWorker();
+
+	SaveWorker(const SaveWorker&) = delete;
+	SaveWorker& operator=(const SaveWorker&) = delete;
+
+	// data carries everything but the layer pixels, one read per layer.
+	// The flattened image feeds the file's previews and, unless pngPath is
+	// empty, the export (.png at pngLevel or .qoi, see ExportPixels).
+	// compositeRead is that image off the GPU; left empty, it's composited
+	// on the CPU when every layer is read. compositeRegion (image space)
+	// says compositeRead only covers that much, which gets patched into the
+	// previews kept from the last save (see HasPreviews). append extends
+	// the file at path in place (see AppendCanvasFile): layers without a
+	// valid read stay as they are on disk, and with no compositeRead the
+	// old previews go back in unchanged.
+	bool Start(const std::string& path, CanvasFileData data, std::vector<Readback> reads,
+			Readback compositeRead, DirtyRect compositeRegion = DirtyRect(), const std::string& pngPath = "", bool append = false, PNG_LEVEL pngLevel = PNG_DEFAULT);
+
+	// main thread, once a frame. True once when a save has completed.
+	bool Poll(SaveResult* out);
+
+	// block until the current save is on disk
+	bool Finish(SaveResult* out);
+
+	// true while the previews of the last successful save are kept and
+	// it was to path, at this size
+	bool HasPreviews(const std::string& path, int width, int height) const;
+	void DropPreviews();
+
+	bool Busy() const;
+	float Progress() const;
+};
+
+#endif // SAVE_WORKER_H
@@ -0,0 +1,49 @@
+#pragma once
+#ifndef SCRATCH_FILE_H
+#define SCRATCH_FILE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Anonymous temp file used as overflow storage. Blocks are written and
+// read back with positional I/O, so callers on different threads never
+// fight over a file cursor. The file is removed by the OS once closed.
+class ScratchFile {
+	struct Extent {
+		uint64_t offset;
+		uint64_t size;
+	};
+
+#if defined(_WIN32)
+	void* handle = nullptr;
+#else
+	int fd = -1;
+#endif
+	// set for good once the file can't be made or written, read from any thread
+	std::atomic<bool> failed{false};
+	uint64_t end = 0;
+	uint64_t used = 0;
+	std::vector<Extent> freeList;
+	std::mutex lock;
+
+	bool open();
+	uint64_t allocate(uint64_t size);
+public:
+	ScratchFile() = default;
+	~ScratchFile();
+
+	ScratchFile(const ScratchFile&) = delete;
+	ScratchFile& operator=(const ScratchFile&) = delete;
+
+	bool Write(const void* data, size_t size, uint64_t* offset);
+	bool Read(uint64_t offset, void* out, size_t size);
+	void Free(uint64_t offset, size_t size);
+
+	bool Usable() const;
+	uint64_t UsedBytes();
+};
+
+#endif // SCRATCH_FILE_H
@@ -0,0 +1,120 @@
+#pragma once
+#ifndef STROKE_LOG_H
+#define STROKE_LOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "gpu.h"
+#include "layer.h"
+#include "raylib.h"
+#include "thread_pool.h"
+
+#define STROKE_LOG_DEFAULT_INTERVAL 16
+#define STROKE_LOG_DEFAULT_BUDGET ((size_t)256 << 20)
+
+struct StrokePoint {
+	Vector2 pos;
+	float pressure;
+	bool moveTo;    // starts a new run instead of connecting to the previous point
+};
+
+struct StrokeCommand {
+	size_t layer;
+	Color color;
+	float size;
+	bool isBrush;
+	std::vector<StrokePoint> points;
+};
+
+// Full copy of a layer taken every few strokes. Read back asynchronously,
+// then deflated on the worker thread.
+struct StrokeKeyframe {
+	int width = 0;
+	int height = 0;
+	size_t serial = 0;
+	size_t bytes = 0;
+	bool dropped = false;
+	Readback read;
+	std::vector<unsigned char> pixels;
+	std::vector<unsigned char> packed;
+	std::mutex lock;
+};
+
+struct StrokeLogStats {
+	size_t depth;
+	size_t redoDepth;
+	size_t keyframes;
+	size_t keyframeBytes;
+	size_t commandBytes;
+};
+
+// Alternative history: every stroke is kept as a small command and undo
+// rebuilds the layer from the nearest keyframe by replaying the commands
+// after it. The interval trades keyframe memory against undo latency.
+class StrokeLog {
+	typedef std::shared_ptr<StrokeKeyframe> KeyframePtr;
+
+	struct LayerLog {
+		std::vector<StrokeCommand> strokes;
+		size_t applied = 0;
+		size_t floor = 0;
+		std::map<size_t, KeyframePtr> keyframes;
+	};
+
+	std::vector<LayerLog> logs;
+	std::deque<size_t> undoOrder;
+	std::deque<size_t> redoOrder;
+	std::vector<KeyframePtr> settling;
+
+	StrokeCommand pending;
+	bool isRecording = false;
+
+	size_t interval;
+	size_t budget;
+	size_t keyframeCount = 0;
+	size_t nextSerial = 0;
+	std::atomic<size_t> keyframeBytes{0};
+	size_t commandBytes = 0;
+
+	ThreadPool compressor{1};
+
+	LayerLog& log_for(size_t layer);
+	void snapshot(LayerLog& log, size_t at, const Layer& layer);
+	bool restore_keyframe(StrokeKeyframe& keyframe, const Layer& layer);
+	void replay(const StrokeCommand& command, const Layer& layer);
+	void report(const StrokeCommand& command, const Layer& layer);
+	void drop_keyframe(const KeyframePtr& keyframe);
+	void trim();
+public:
+	StrokeLog(size_t interval = STROKE_LOG_DEFAULT_INTERVAL, size_t budget = STROKE_LOG_DEFAULT_BUDGET);
+	~StrokeLog();
+
+	StrokeLog(const StrokeLog&) = delete;
+	StrokeLog& operator=(const StrokeLog&) = delete;
+
+	void BeginStroke(const Layer& layer, size_t layerIndex, Color color, float size, bool isBrush);
+	void AddSegment(Vector2 from, Vector2 to, float radius);
+	void EndStroke(const Layer& layer);
+
+	void Update();
+	// keyframes still waiting on the GPU
+	bool Settling() const;
+	bool Undo(std::deque<Layer>& layers);
+	bool Redo(std::deque<Layer>& layers);
+
+	void SwapLayers(size_t a, size_t b);
+	void Clear();
+
+	StrokeLogStats Stats() const;
+
+	// called with the area of the stroke an undo or redo took away or put back
+	LayerRegionFn onRestore;
+};
+
+#endif // STROKE_LOG_H
@@ -0,0 +1,43 @@
+#pragma once
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	size_t running = 0;
+	bool stopping = false;
+
+	void work();
+public:
+	// 0 threads means one per hardware thread
+	ThreadPool(size_t threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void Submit(std::function<void()> job);
+	void Wait();
+	size_t Size() const;
+
+	// runs fn(0..count-1) across the workers and the calling thread,
+	// returns once every index is done. Only waits on its own work.
+	void ParallelFor(size_t count, const std::function<void(size_t)>& fn);
+};
+
+// process-wide pool sized to the machine, for save/load style bulk work
+ThreadPool& SharedPool();
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,48 @@
+#pragma once
+#ifndef TILE_CODEC_H
+#define TILE_CODEC_H
+
+#include <cstddef>
+#include <vector>
+
+// how a tile's pixels are packed in a .mc file, stored per tile from v5
+// on. Older files are all deflate.
+enum CANVAS_CODEC {
+	CANVAS_CODEC_DEFLATE,       // raylib's CompressData on the raw pixels
+	CANVAS_CODEC_RUNS,          // pixel runs only, see below
+	CANVAS_CODEC_RUNS_DEFLATE,  // the runs, then deflated
+	CANVAS_CODEC_COUNT
+};
+
+// The runs codec works on whole RGBA pixels, which is what flat artwork
+// repeats. A tile is a list of ops, each a byte with the op in the top
+// two bits and the length - 1 in the low six. A length field of 63 is
+// followed by a LEB128 varint with the rest of the length - 64.
+//   literal  that many pixels follow as 4 bytes each
+//   repeat   the pixel before, again
+//   above    copy from the row above
+//   zero     transparent black
+// It's one pass with no search in either direction, so it runs at
+// memory speed, at the cost of ratio on anything noisy.
+bool EncodeTile(int codec, const unsigned char* pixels, int width, int height, std::vector<unsigned char>& out);
+
+// writes the tile into out, stride bytes between rows. False if the
+// blob is corrupt or doesn't come to exactly width*height pixels.
+bool DecodeTile(int codec, const unsigned char* data, size_t size, int width, int height, unsigned char* out, size_t stride);
+
+// Raw deflate (what CompressData writes) into out, never past cap.
+// Returns the bytes written, or -1 if the stream is corrupt, runs off
+// the end of data or wants more room than cap. DecompressData allocates
+// a 64MB scratch buffer per call, and raylib's sinflate under it lets a
+// match run past the end of its output, so nothing read from a file
+// goes through either.
+long long Inflate(const unsigned char* data, size_t size, unsigned char* out, size_t cap);
+
+// Inflate that has to fill outSize exactly
+bool InflateExact(const unsigned char* data, size_t size, unsigned char* out, size_t outSize);
+
+const char* CanvasCodecName(int codec);
+// "deflate", "runs" or "runs+deflate"
+bool ParseCanvasCodec(const char* name, CANVAS_CODEC& out);
+
+#endif // TILE_CODEC_H
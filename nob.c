@@ -4,12 +4,15 @@
 
 #define COMPILER "g++"
 #define EXECUTABLE "myCanvas"
+#define CLI_EXECUTABLE "mycanvas-cli"
 #define BUILD_FOLDER "build/"
 #define BUILD_LIBS_FOLDER "build/libs/"
 #if defined(_WIN32)
 #define OUTPUT_EXEC BUILD_FOLDER EXECUTABLE".exe"
+#define OUTPUT_CLI_EXEC BUILD_FOLDER CLI_EXECUTABLE".exe"
 #elif defined(__linux__)
 #define OUTPUT_EXEC BUILD_FOLDER EXECUTABLE
+#define OUTPUT_CLI_EXEC BUILD_FOLDER CLI_EXECUTABLE
 #endif
 
 Procs global_procs = {0};
@@ -336,7 +339,34 @@ int main(int argc, char** argv){
 		"src/canvas_update.cpp",
 		"src/helpers.cpp",
 		"src/events.cpp",
-		"src/SDLHandler.cpp"
+		"src/SDLHandler.cpp",
+		"src/history.cpp",
+		"src/gpu.cpp",
+		"src/thread_pool.cpp",
+		"src/scratch_file.cpp",
+		"src/stroke_log.cpp",
+		"src/canvas_file.cpp",
+		"src/save_worker.cpp",
+		"src/mapped_file.cpp",
+		"src/layer_stream.cpp",
+		"src/autosave.cpp",
+		"src/compositor.cpp",
+		"src/image_export.cpp",
+		"src/tile_codec.cpp",
+		"src/dirty_tracker.cpp",
+		"src/gpu_compositor.cpp",
+		"src/profiler.cpp"
+	};
+
+	// headless tools, shares objects with the app
+	const char* cliSourcesToBuild[] = {
+		"src/cli.cpp",
+		"src/canvas_file.cpp",
+		"src/compositor.cpp",
+		"src/image_export.cpp",
+		"src/thread_pool.cpp",
+		"src/mapped_file.cpp",
+		"src/tile_codec.cpp"
 	};
 
 	const char* paths[] = {
@@ -385,14 +415,31 @@ int main(int argc, char** argv){
 			paths,          ARRAY_LEN(paths),
 		true);
 
-	if(!generate_compile_commands(scripts)) return 1;
+	buildScripts cliScripts = generateBuildScripts(
+			cliSourcesToBuild, ARRAY_LEN(cliSourcesToBuild),
+			paths,             ARRAY_LEN(paths),
+		true);
+
+	buildScripts allScripts = {0};
+	nob_da_append_many(&allScripts, scripts.items, scripts.count);
+	nob_da_append(&allScripts, cliScripts.items[0]);
+	if(!generate_compile_commands(allScripts)) return 1;
 
 	buildObjects objects = executeBuildScripts(scripts, async);
 
 	if(async)
-		nob_procs_wait(global_procs);
+		nob_procs_wait_and_reset(&global_procs);
 
 	bool success = compileObjects(objects, links, cFlags, OUTPUT_EXEC);
+
+	// after the app so the shared objects are already up to date
+	if(success) {
+		buildObjects cliObjects = executeBuildScripts(cliScripts, async);
+		if(async)
+			nob_procs_wait_and_reset(&global_procs);
+		success = compileObjects(cliObjects, links, cFlags, OUTPUT_CLI_EXEC);
+	}
+
 	if(success)
 		nob_log(NOB_INFO, "Compilation Succesful!");
 	else
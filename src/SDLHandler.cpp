@@ -1,5 +1,7 @@
 #include "SDLHandler.h"
 #include "SDL3/SDL_events.h"
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
 
 namespace {
@@ -14,10 +16,15 @@ namespace {
     bool penJustPressedFlag = false;
     bool penJustReleasedFlag = false;
 
+    // events can be pushed from other threads, the watch runs on theirs
+    std::atomic<bool> activity{false};
+
 }
 
 bool SDLCALL WatchSDLEvent(void*, SDL_Event* event)
 {
+    activity = true;
+
     switch (event->type)
     {
         case SDL_EVENT_PEN_PROXIMITY_IN:
@@ -135,3 +142,13 @@ bool ConsumeTabletPenReleased() {
     penJustReleasedFlag = false;
     return value;
 }
+
+bool ConsumeSDLActivity() {
+    return activity.exchange(false);
+}
+
+void WaitForSDLEvent(double timeout) {
+    // a NULL event only peeks, so raylib still gets to handle it
+    Sint32 ms = timeout < 0.0 ? -1 : (Sint32)std::min(timeout * 1000.0 + 0.5, 2147483647.0);
+    SDL_WaitEventTimeout(nullptr, ms);
+}
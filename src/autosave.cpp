@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "autosave.h"
+#include "raylib.h"
+#include "tile_codec.h"
+
+namespace {
+
+const size_t JOURNAL_HEADER_SIZE = 4 + 4*4 + 8;
+
+void put_u32(std::vector<unsigned char>& out, uint32_t v) {
+	for (int i = 0; i < 4; ++i)
+		out.push_back((unsigned char)(v >> (8 * i)));
+}
+
+void put_u64(std::vector<unsigned char>& out, uint64_t v) {
+	for (int i = 0; i < 8; ++i)
+		out.push_back((unsigned char)(v >> (8 * i)));
+}
+
+uint32_t get_u32(const unsigned char* p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint64_t get_u64(const unsigned char* p) {
+	return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+// FNV-1a, only there to spot a record the crash cut short
+uint32_t checksum(const unsigned char* data, size_t size) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+bool parse_record(const unsigned char* p, size_t size, const Journal& journal, JournalRecord& out) {
+	const unsigned char* end = p + size;
+	if (end - p < 4)
+		return false;
+	uint32_t layerCount = get_u32(p);
+	p += 4;
+	if ((uint64_t)(end - p) < (uint64_t)layerCount * 8 + 4)
+		return false;
+
+	out.layers.resize(layerCount);
+	for (CanvasFileLayer& layer : out.layers) {
+		layer.opacity = p[0];
+		layer.blendMode = (int)get_u32(p + 4);
+		p += 8;
+	}
+
+	uint32_t tileCount = get_u32(p);
+	p += 4;
+	int tilesX = (journal.width  + CANVAS_FILE_TILE_SIZE - 1) / CANVAS_FILE_TILE_SIZE;
+	int tilesY = (journal.height + CANVAS_FILE_TILE_SIZE - 1) / CANVAS_FILE_TILE_SIZE;
+	for (uint32_t i = 0; i < tileCount; ++i) {
+		if (end - p < 16)
+			return false;
+		JournalTile tile = { get_u32(p), get_u32(p + 4), get_u32(p + 8), {} };
+		uint32_t packedSize = get_u32(p + 12);
+		p += 16;
+		if (tile.layer >= layerCount || tile.tileX >= (uint32_t)tilesX || tile.tileY >= (uint32_t)tilesY)
+			return false;
+		if ((size_t)(end - p) < packedSize)
+			return false;
+
+		if (packedSize > 0) {
+			int w = std::min(CANVAS_FILE_TILE_SIZE, journal.width  - (int)tile.tileX * CANVAS_FILE_TILE_SIZE);
+			int h = std::min(CANVAS_FILE_TILE_SIZE, journal.height - (int)tile.tileY * CANVAS_FILE_TILE_SIZE);
+			tile.pixels.resize((size_t)w * h * 4);
+			if (!InflateExact(p, packedSize, tile.pixels.data(), tile.pixels.size()))
+				return false;
+		}
+		p += packedSize;
+		out.tiles.push_back(std::move(tile));
+	}
+	return true;
+}
+
+}
+
+bool ReadJournal(const std::string& path, Journal& out, bool headerOnly) {
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+		return false;
+
+	std::streamoff size = file.tellg();
+	if (size < (std::streamoff)JOURNAL_HEADER_SIZE)
+		return false;
+	std::vector<unsigned char> buf(headerOnly ? JOURNAL_HEADER_SIZE : (size_t)size);
+	file.seekg(0);
+	file.read((char*)buf.data(), buf.size());
+	if ((size_t)file.gcount() != buf.size())
+		return false;
+
+	const unsigned char* p = buf.data();
+	if (memcmp(p, AUTOSAVE_JOURNAL_MAGIC, 4) != 0 || get_u32(p + 4) != AUTOSAVE_JOURNAL_VERSION)
+		return false;
+	if (get_u32(p + 16) != CANVAS_FILE_TILE_SIZE)
+		return false;
+	out.width = (int)get_u32(p + 8);
+	out.height = (int)get_u32(p + 12);
+	out.baseBytes = get_u64(p + 20);
+	if (out.width <= 0 || out.height <= 0)
+		return false;
+	if (headerOnly)
+		return true;
+
+	size_t at = JOURNAL_HEADER_SIZE;
+	while (buf.size() - at >= 8) {
+		uint32_t recordSize = get_u32(buf.data() + at);
+		uint32_t sum = get_u32(buf.data() + at + 4);
+		at += 8;
+		if (buf.size() - at < recordSize || checksum(buf.data() + at, recordSize) != sum)
+			break;
+
+		JournalRecord record;
+		if (!parse_record(buf.data() + at, recordSize, out, record))
+			break;
+		out.records.push_back(std::move(record));
+		at += recordSize;
+	}
+	return true;
+}
+
+Autosave::~Autosave() {
+	writer.Wait();
+}
+
+void Autosave::cancel() {
+	record = nullptr;
+	queued.clear();
+	nextQueued = 0;
+	inFlight.clear();
+}
+
+void Autosave::Open(const std::string& path, int width, int height, uint64_t baseBytes, bool keepExisting) {
+	cancel();
+	this->path = path;
+	this->width = width;
+	this->height = height;
+	this->baseBytes = baseBytes;
+	writer.Submit([this, path, keepExisting] {
+		std::error_code err;
+		hasHeader = keepExisting;
+		journalBytes = keepExisting ? std::filesystem::file_size(path, err) : 0;
+		if (err)
+			hasHeader = false;
+	});
+}
+
+void Autosave::Begin(std::vector<CanvasFileLayer> layers, std::vector<JournalTileRef> tiles) {
+	if (path.empty() || Busy())
+		return;
+	record = std::make_shared<JournalRecord>();
+	record->layers = std::move(layers);
+	queued = std::move(tiles);
+	nextQueued = 0;
+}
+
+void Autosave::Update(const std::deque<Layer>& layers, double budget) {
+	double start = GetTime();
+	while (record && GetTime() - start < budget) {
+		// copy out in order as the GPU delivers
+		if (!inFlight.empty() && inFlight.front().read.Ready()) {
+			Capture& capture = inFlight.front();
+			JournalTile tile = { (uint32_t)capture.ref.layer, (uint32_t)capture.ref.tileX, (uint32_t)capture.ref.tileY, {} };
+			tile.pixels.resize((size_t)capture.read.Width() * capture.read.Height() * 4);
+			capture.read.Resolve(tile.pixels.data());
+			record->tiles.push_back(std::move(tile));
+			inFlight.pop_front();
+			continue;
+		}
+
+		if (nextQueued < queued.size() && inFlight.size() < AUTOSAVE_MAX_IN_FLIGHT) {
+			const JournalTileRef& ref = queued[nextQueued++];
+			if (ref.layer >= layers.size() || !layers[ref.layer].Resident())
+				continue;
+			int x = ref.tileX * CANVAS_FILE_TILE_SIZE;
+			int y = ref.tileY * CANVAS_FILE_TILE_SIZE;
+			int w = std::min(CANVAS_FILE_TILE_SIZE, width - x);
+			int h = std::min(CANVAS_FILE_TILE_SIZE, height - y);
+			inFlight.push_back(Capture{ ref, Readback(layers[ref.layer].tex, x, y, w, h) });
+			continue;
+		}
+
+		if (inFlight.empty() && nextQueued == queued.size())
+			submit();
+		break;
+	}
+}
+
+void Autosave::submit() {
+	std::shared_ptr<JournalRecord> done = record;
+	std::string path = this->path;
+	int width = this->width;
+	int height = this->height;
+	uint64_t baseBytes = this->baseBytes;
+	writer.Submit([this, done, path, width, height, baseBytes] {
+		append(path, width, height, baseBytes, *done);
+	});
+	cancel();
+}
+
+void Autosave::append(const std::string& path, int width, int height, uint64_t baseBytes, const JournalRecord& record) {
+	std::vector<unsigned char> body;
+	put_u32(body, (uint32_t)record.layers.size());
+	for (const CanvasFileLayer& layer : record.layers) {
+		body.push_back(layer.opacity);
+		body.insert(body.end(), 3, 0);
+		put_u32(body, (uint32_t)layer.blendMode);
+	}
+
+	put_u32(body, (uint32_t)record.tiles.size());
+	for (const JournalTile& tile : record.tiles) {
+		put_u32(body, tile.layer);
+		put_u32(body, tile.tileX);
+		put_u32(body, tile.tileY);
+
+		bool empty = std::all_of(tile.pixels.begin(), tile.pixels.end(), [](unsigned char c) { return c == 0; });
+		int size = 0;
+		unsigned char* packed = empty ? nullptr : CompressData(tile.pixels.data(), (int)tile.pixels.size(), &size);
+		if (!empty && !packed)
+			return;
+		put_u32(body, (uint32_t)size);
+		if (packed)
+			body.insert(body.end(), packed, packed + size);
+		MemFree(packed);
+	}
+
+	std::vector<unsigned char> out;
+	if (!hasHeader) {
+		out.insert(out.end(), AUTOSAVE_JOURNAL_MAGIC, AUTOSAVE_JOURNAL_MAGIC + 4);
+		put_u32(out, AUTOSAVE_JOURNAL_VERSION);
+		put_u32(out, (uint32_t)width);
+		put_u32(out, (uint32_t)height);
+		put_u32(out, CANVAS_FILE_TILE_SIZE);
+		put_u64(out, baseBytes);
+	}
+	put_u32(out, (uint32_t)body.size());
+	put_u32(out, checksum(body.data(), body.size()));
+	out.insert(out.end(), body.begin(), body.end());
+
+	bool ok;
+	{
+		std::ofstream file(path, std::ios::binary | (hasHeader ? std::ios::app : std::ios::trunc));
+		if (!file.is_open())
+			return;
+		file.write((const char*)out.data(), out.size());
+		file.close();
+		ok = !file.fail();
+	}
+
+	// cut a half written record off again, or every later one would sit
+	// behind it where ReadJournal never looks
+	std::error_code err;
+	if (!ok) {
+		if (hasHeader)
+			std::filesystem::resize_file(path, journalBytes, err);
+		return;
+	}
+	journalBytes += out.size();
+	hasHeader = true;
+}
+
+void Autosave::Discard(uint64_t baseBytes) {
+	cancel();
+	this->baseBytes = baseBytes;
+	std::string path = this->path;
+	writer.Submit([this, path] {
+		std::error_code err;
+		std::filesystem::remove(path, err);
+		hasHeader = false;
+		journalBytes = 0;
+	});
+}
+
+bool Autosave::Busy() const {
+	return record != nullptr;
+}
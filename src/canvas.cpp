@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <cstdio>
 #include <iostream>
 #include <cstring>
+#include <limits>
 
 #include "SDLHandler.h"
 
@@ -8,13 +10,18 @@
 #include "raylib.h"
 #include "raygui.h"
 
-Canvas::Canvas(int width, int height, size_t maxLayers, std::string fileName)
-    : width(width), height(height),
+Canvas::Canvas(int width, int height, size_t maxLayers, std::string fileName, CanvasConfig config)
+    : history(config.historyBudget, config.historySpillBudget, config.historyVramBudget),
+	  strokeLog(config.strokeKeyframeInterval, config.historyBudget), historyMode(config.historyMode), lazyLoad(config.lazyLoad),
+	  autosaveInterval(config.autosaveInterval), autosaveBudget(config.autosaveBudget),
+	  exportFormat(config.exportFormat), tileCodec(config.tileCodec), width(width), height(height),
       brushSize(20.0f), eraserSize(20.0f), selectedLayer(0),
       mouseState(IDLE), prevMousePos({-1,-1}), transparency(255),
       fileName(fileName), clr(BLACK), isBrush(true), scale(1.0f),
 	  isMirror(false), isColorPicking(false)
 {
+	history.onRestore = [this](size_t layer, int x, int y, int w, int h) { mark_dirty(layer, x, y, w, h); };
+	strokeLog.onRestore = history.onRestore;
 	handle_file_loading(); // file loading
 	handle_window(); // set window stuff hmhmhmm
 }
@@ -22,12 +29,18 @@ Canvas::Canvas(int width, int height, size_t maxLayers, std::string fileName)
 void Canvas::Update() {
 	handle_dropped_files();
 
-	if(droppedFile.length()) 
+	if(droppedFile.length() || pendingJournal.length())
 		return;
 
 	if (!isPenInProximity)
 		pointerPos = GetMousePosition();
 
+	history.Update();
+	strokeLog.Update();
+	update_saving();
+	update_autosave();
+	stream_layers();
+
 	handle_pen_events();
 	if (handle_key_events()) return;
 	
@@ -35,8 +48,33 @@ void Canvas::Update() {
 	prevMousePos = GetMousePos();
 }
 
+double Canvas::IdleTimeout() {
+	if (saver.Busy() || stream.IsOpen() || autosave.Busy() || history.Settling() || strokeLog.Settling())
+		return 0.0;
+	// the color picker is waiting on its copy of the layer
+	if (colorPickRead.Valid() && currentLayerCache.data == nullptr)
+		return 0.0;
+
+	double now = GetTime();
+	if (showDirty)
+		for (double changed : dirtyFlash)
+			if (now - changed < DIRTY_FLASH_SECONDS)
+				return 0.0;
+
+	double wait = std::numeric_limits<double>::infinity();
+	// notifications only count down while they're drawn
+	if (!isUiHidden)
+		for (const NotifMessage& message : messageQueue)
+			wait = std::min(wait, (double)message.lifeTime);
+	// Update() holds off on everything while a dialog is up
+	if (autosaveInterval > 0.0 && droppedFile.empty() && pendingJournal.empty())
+		wait = std::min(wait, lastAutosave + autosaveInterval - now);
+	return std::max(wait, 0.0);
+}
+
 void Canvas::Render() {
 	render_layers();
+	render_dirty_overlay();
 
 	if(isUiHidden)
 		return;
@@ -49,21 +87,57 @@ void Canvas::Render() {
 	if(this->droppedFile.length()) {
 		ShowCursor();
 		Rectangle rec = {GetScreenWidth()/2.0f - 150, 100, 300, 150};
+		const char* opening = droppedInfo.length()
+			? TextFormat("\n\nOpening %s (%s)", GetFileName(droppedFile.c_str()), droppedInfo.c_str())
+			: "";
 		int result = GuiMessageBox(rec, 
 				TextFormat("Unsaved Changes to %s", fileName.c_str()), 
-				TextFormat("You have unsaved changes to %s\nDo you want to overwrite this?", fileName.c_str()), 
+				TextFormat("You have unsaved changes to %s\nDo you want to overwrite this?%s", fileName.c_str(), opening), 
 				"Yes;No"
 			);
 
+		// what's being opened, under the box
+		if (droppedThumbnail.id != 0) {
+			float scale = std::min(1.0f, 200.0f / std::max(droppedThumbnail.width, droppedThumbnail.height));
+			Rectangle source = { 0, 0, (float)droppedThumbnail.width, (float)droppedThumbnail.height };
+			Rectangle dest = { GetScreenWidth()/2.0f - droppedThumbnail.width * scale / 2.0f, rec.y + rec.height + 10,
+				droppedThumbnail.width * scale, droppedThumbnail.height * scale };
+			DrawRectangleRec(dest, LIGHTGRAY);
+			DrawTexturePro(droppedThumbnail, source, dest, {0, 0}, 0.0f, WHITE);
+		}
+
 		if(result >= 0) {
 			if(result == 1) {
 				this->fileName = this->droppedFile;
 				handle_file_loading();
 			}
 			this->droppedFile = "";
+			unload_dropped_summary();
 
 			HideCursor();
 		} 
 	}
 
+	if(this->pendingJournal.length()) {
+		ShowCursor();
+		Rectangle rec = {GetScreenWidth()/2.0f - 150, 100, 300, 150};
+		int result = GuiMessageBox(rec,
+				"Recover Autosave",
+				TextFormat("%s has autosaved changes that were never saved\nDo you want to restore them?", pendingJournal.c_str()),
+				"Yes;No"
+			);
+
+		if(result >= 0) {
+			if(result == 1) {
+				replay_journal();
+			} else {
+				// the old journal is overwritten by the next autosave
+				autosave.Open(pendingJournal, width, height, journalBase);
+			}
+			this->pendingJournal = "";
+
+			HideCursor();
+		}
+	}
+
 }
@@ -0,0 +1,1085 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "canvas_file.h"
+#include "mapped_file.h"
+#include "raylib.h"
+#include "thread_pool.h"
+
+namespace {
+
+const size_t HEADER_SIZE_V2 = 4 + 4*6 + 8;
+const size_t HEADER_SIZE = HEADER_SIZE_V2 + 8;
+const size_t HEADER_SIZE_V4 = 4 + 4 + 8;
+const size_t INDEX_HEAD_SIZE = 4*7;
+const size_t PREVIEW_ENTRY_SIZE = 4*2 + 8 + 4;
+const size_t TOC_ENTRY_SIZE = 4*3 + 8 + 4;
+const size_t TOC_ENTRY_SIZE_V5 = TOC_ENTRY_SIZE + 4;
+const size_t SUMMARY_HEAD_SIZE = 4*2;
+const size_t SUMMARY_BODY_HEAD_SIZE = 4*7;
+const size_t SUMMARY_LAYER_SIZE = 8;
+
+void put_u32(std::vector<unsigned char>& out, uint32_t v) {
+	for (int i = 0; i < 4; ++i)
+		out.push_back((unsigned char)(v >> (8*i)));
+}
+
+void put_u64(std::vector<unsigned char>& out, uint64_t v) {
+	for (int i = 0; i < 8; ++i)
+		out.push_back((unsigned char)(v >> (8*i)));
+}
+
+uint32_t get_u32(const unsigned char* p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint64_t get_u64(const unsigned char* p) {
+	return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+uint32_t fnv1a(const unsigned char* p, size_t n) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < n; ++i)
+		hash = (hash ^ p[i]) * 16777619u;
+	return hash;
+}
+
+// largest side a file may claim, keeps width*height*4 and the tile grid
+// far from overflowing whatever the header says
+const uint32_t MAX_SIDE = 1u << 16;
+
+// where v6 files start their blobs
+uint64_t blobs_start(uint32_t version) {
+	return HEADER_SIZE_V4 + (version >= 6 ? CANVAS_FILE_SUMMARY_SIZE : 0);
+}
+
+// Bounds checked cursor over a little endian block. Reading past the end
+// gives zeros and clears ok, so a run of fields is checked once after.
+struct ByteReader {
+	const unsigned char* p;
+	const unsigned char* end;
+	bool ok = true;
+
+	size_t left() const {
+		return (size_t)(end - p);
+	}
+
+	// count records of recordSize fit in what's left
+	bool fits(uint64_t count, size_t recordSize) const {
+		return ok && count <= left() / recordSize;
+	}
+
+	const unsigned char* take(size_t n) {
+		static const unsigned char zeros[8] = {};
+		if (!ok || n > left()) {
+			ok = false;
+			return zeros;
+		}
+		const unsigned char* at = p;
+		p += n;
+		return at;
+	}
+
+	void skip(size_t n) {
+		take(n);
+	}
+
+	uint8_t u8() {
+		return *take(1);
+	}
+
+	uint32_t u32() {
+		return get_u32(take(4));
+	}
+
+	uint64_t u64() {
+		return get_u64(take(8));
+	}
+};
+
+bool tile_is_empty(const CanvasFileLayer& layer, int width, int x, int y, int w, int h) {
+	for (int row = 0; row < h; ++row) {
+		const unsigned char* p = layer.pixels.data() + ((size_t)(y + row) * width + x) * 4;
+		for (int i = 0; i < w * 4; ++i)
+			if (p[i])
+				return false;
+	}
+	return true;
+}
+
+// cursor over the text parts of a v1 file
+struct TextCursor {
+	const unsigned char* p;
+	const unsigned char* end;
+
+	bool read_int(int& out) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+			p++;
+		bool negative = p < end && *p == '-';
+		if (negative)
+			p++;
+		if (p >= end || *p < '0' || *p > '9')
+			return false;
+		long long value = 0;
+		while (p < end && *p >= '0' && *p <= '9') {
+			value = value * 10 + (*p++ - '0');
+			if (value > 0x7fffffff)
+				return false;
+		}
+		out = (int)(negative ? -value : value);
+		return true;
+	}
+
+	// rest of the line, newline included
+	void skip_line() {
+		while (p < end && *p != '\n')
+			p++;
+		if (p < end)
+			p++;
+	}
+
+	void skip_newline() {
+		if (p < end && *p == '\n')
+			p++;
+	}
+};
+
+// old text header format, one deflated blob per layer
+bool index_v1(const unsigned char* data, size_t size, CanvasFileIndex& out) {
+	TextCursor cur = { data, data + size };
+
+	int w, h, layerCount;
+	if (!cur.read_int(w) || !cur.read_int(h) || !cur.read_int(layerCount))
+		return false;
+	if (w <= 0 || h <= 0 || w > (int)MAX_SIDE || h > (int)MAX_SIDE || layerCount < 0)
+		return false;
+	cur.skip_line();
+
+	out.version = 1;
+	out.width = w;
+	out.height = h;
+	out.tileSize = 0;
+
+	int colorCount = 0;
+	cur.read_int(colorCount);
+	cur.skip_line();
+	for (int i = 0; i < colorCount && cur.p < cur.end; ++i) {
+		int red = 0, green = 0, blue = 0;
+		cur.read_int(red);
+		cur.read_int(green);
+		cur.read_int(blue);
+		cur.skip_line();
+		out.colors.push_back(Color{(unsigned char)red, (unsigned char)green, (unsigned char)blue, 255});
+	}
+	cur.skip_newline();
+
+	for (int i = 0; i < layerCount; i++) {
+		int opacityInt, blendMode, compressedSize;
+		if (!cur.read_int(opacityInt) || !cur.read_int(blendMode) || !cur.read_int(compressedSize))
+			break;
+		cur.skip_line();
+		if (compressedSize < 0 || compressedSize > cur.end - cur.p)
+			break;
+
+		CanvasFileLayer layer;
+		layer.opacity = (unsigned char)opacityInt;
+		layer.blendMode = blendMode;
+		out.layers.push_back(std::move(layer));
+		out.tiles.push_back({ CanvasFileTile{ (uint32_t)i, 0, 0, (uint64_t)(cur.p - data), (uint32_t)compressedSize } });
+
+		cur.p += compressedSize;
+		cur.skip_newline();
+	}
+	return true;
+}
+
+// what the index has to agree with, checked entry by entry as it's read
+struct IndexBounds {
+	uint32_t width, height, layerCount;
+	uint32_t tilesX, tilesY;
+	uint64_t blobsBegin, blobsEnd;
+};
+
+IndexBounds bounds_for(uint32_t width, uint32_t height, uint32_t tileSize, uint32_t layerCount, uint64_t blobsBegin, uint64_t blobsEnd) {
+	return IndexBounds{ width, height, layerCount, (width + tileSize - 1) / tileSize, (height + tileSize - 1) / tileSize, blobsBegin, blobsEnd };
+}
+
+// a blob has to sit between the header and the index pointing at it, and
+// fit an int for the decoders
+bool blob_in(const CanvasFileTile& entry, const IndexBounds& b) {
+	return entry.size <= INT32_MAX && entry.offset >= b.blobsBegin && entry.offset <= b.blobsEnd
+		&& entry.size <= b.blobsEnd - entry.offset;
+}
+
+void read_colors(ByteReader& in, uint32_t count, std::deque<Color>& out) {
+	for (uint32_t i = 0; i < count; ++i) {
+		const unsigned char* p = in.take(3);
+		out.push_back(Color{ p[0], p[1], p[2], 255 });
+	}
+}
+
+void read_layers(ByteReader& in, uint32_t count, std::vector<CanvasFileLayer>& out) {
+	out.resize(count);
+	for (CanvasFileLayer& layer : out) {
+		layer.opacity = in.u8();
+		in.skip(3);
+		layer.blendMode = (int)in.u32();
+	}
+}
+
+bool read_preview(ByteReader& in, uint32_t level, const IndexBounds& b, CanvasFileTile& entry) {
+	entry = { level, in.u32(), in.u32(), in.u64(), in.u32() };
+	return entry.tileX && entry.tileY && entry.tileX <= b.width && entry.tileY <= b.height && blob_in(entry, b);
+}
+
+bool read_tile(ByteReader& in, bool withCodec, const IndexBounds& b, CanvasFileTile& entry) {
+	entry = { in.u32(), in.u32(), in.u32(), in.u64(), in.u32() };
+	if (withCodec) {
+		entry.codec = in.u8();
+		in.skip(3);
+	}
+	return entry.layer < b.layerCount && entry.tileX < b.tilesX && entry.tileY < b.tilesY
+		&& entry.codec < CANVAS_CODEC_COUNT && blob_in(entry, b);
+}
+
+// two entries for one tile would decode into the same rectangle from two
+// workers at once
+bool tiles_unique(const std::vector<std::vector<CanvasFileTile>>& tiles) {
+	std::vector<uint64_t> keys;
+	for (const std::vector<CanvasFileTile>& layer : tiles) {
+		keys.clear();
+		for (const CanvasFileTile& tile : layer)
+			keys.push_back(((uint64_t)tile.tileY << 32) | tile.tileX);
+		std::sort(keys.begin(), keys.end());
+		if (std::adjacent_find(keys.begin(), keys.end()) != keys.end())
+			return false;
+	}
+	return true;
+}
+
+bool sane_size(uint32_t width, uint32_t height, uint32_t tileSize) {
+	return width && height && tileSize && width <= MAX_SIDE && height <= MAX_SIDE && tileSize <= MAX_SIDE;
+}
+
+bool index_tiled(const unsigned char* data, size_t size, CanvasFileIndex& out) {
+	ByteReader in = { data + 4, data + size };
+	uint32_t version    = in.u32();
+	uint32_t width      = in.u32();
+	uint32_t height     = in.u32();
+	uint32_t layerCount = in.u32();
+	uint32_t tileSize   = in.u32();
+	uint32_t colorCount = in.u32();
+	uint64_t tocOffset  = in.u64();
+	uint64_t previewOffset = version >= 3 ? in.u64() : 0;
+	if (!in.ok || (version != 2 && version != 3) || !sane_size(width, height, tileSize))
+		return false;
+	if ((uint64_t)colorCount * 3 + (uint64_t)layerCount * 8 > in.left())
+		return false;
+
+	out.version = (int)version;
+	out.width = (int)width;
+	out.height = (int)height;
+	out.tileSize = (int)tileSize;
+	read_colors(in, colorCount, out.colors);
+	read_layers(in, layerCount, out.layers);
+	out.tiles.resize(layerCount);
+	if (!in.ok)
+		return false;
+
+	// v2 and v3 only promise their blobs are somewhere past the header
+	IndexBounds b = bounds_for(width, height, tileSize, layerCount, (uint64_t)(in.p - data), size);
+	if (tocOffset < b.blobsBegin || tocOffset > size)
+		return false;
+	ByteReader toc = { data + tocOffset, data + size };
+	uint32_t entryCount = toc.u32();
+	if (!toc.fits(entryCount, TOC_ENTRY_SIZE))
+		return false;
+	for (uint32_t i = 0; i < entryCount; ++i) {
+		CanvasFileTile entry;
+		if (!read_tile(toc, false, b, entry))
+			return false;
+		out.tiles[entry.layer].push_back(entry);
+	}
+
+	if (previewOffset) {
+		if (previewOffset < b.blobsBegin || previewOffset > size)
+			return false;
+		ByteReader table = { data + previewOffset, data + size };
+		uint32_t levels = table.u32();
+		if (!table.fits(levels, PREVIEW_ENTRY_SIZE))
+			return false;
+		out.previews.reserve(levels);
+		for (uint32_t i = 0; i < levels; ++i) {
+			CanvasFileTile entry;
+			if (!read_preview(table, i, b, entry))
+				return false;
+			out.previews.push_back(entry);
+		}
+	}
+	return tiles_unique(out.tiles);
+}
+
+// v4 and up keep everything that changes between saves in one index
+// block at the end, which an appended save replaces by writing a new one.
+// Every count is checked against the block before anything is read, and
+// every blob has to lie in [blobsBegin, blobsEnd).
+bool parse_index_block(const unsigned char* block, size_t blockSize, uint64_t blobsBegin, uint64_t blobsEnd, uint32_t version, CanvasFileIndex& out) {
+	ByteReader in = { block, block + blockSize };
+	uint32_t width        = in.u32();
+	uint32_t height       = in.u32();
+	uint32_t tileSize     = in.u32();
+	uint32_t layerCount   = in.u32();
+	uint32_t colorCount   = in.u32();
+	uint32_t previewCount = in.u32();
+	uint32_t entryCount   = in.u32();
+	if (!in.ok || !sane_size(width, height, tileSize))
+		return false;
+
+	size_t entrySize = version >= 5 ? TOC_ENTRY_SIZE_V5 : TOC_ENTRY_SIZE;
+	uint64_t need = (uint64_t)colorCount * 3 + (uint64_t)layerCount * 8
+		+ (uint64_t)previewCount * PREVIEW_ENTRY_SIZE + (uint64_t)entryCount * entrySize;
+	if (need > in.left())
+		return false;
+
+	out.version = (int)version;
+	out.width = (int)width;
+	out.height = (int)height;
+	out.tileSize = (int)tileSize;
+	out.liveBytes = blobs_start(version) + INDEX_HEAD_SIZE + need;
+	read_colors(in, colorCount, out.colors);
+	read_layers(in, layerCount, out.layers);
+	out.tiles.resize(layerCount);
+
+	IndexBounds b = bounds_for(width, height, tileSize, layerCount, blobsBegin, blobsEnd);
+	out.previews.reserve(previewCount);
+	for (uint32_t i = 0; i < previewCount; ++i) {
+		CanvasFileTile entry;
+		if (!read_preview(in, i, b, entry))
+			return false;
+		out.previews.push_back(entry);
+		out.liveBytes += entry.size;
+	}
+
+	for (uint32_t i = 0; i < entryCount; ++i) {
+		CanvasFileTile entry;
+		if (!read_tile(in, version >= 5, b, entry))
+			return false;
+		out.tiles[entry.layer].push_back(entry);
+		out.liveBytes += entry.size;
+	}
+	return in.ok && tiles_unique(out.tiles);
+}
+
+bool index_v4(const unsigned char* data, size_t size, CanvasFileIndex& out) {
+	if (size < HEADER_SIZE_V4)
+		return false;
+	uint64_t indexOffset = get_u64(data + 8);
+	uint32_t version = get_u32(data + 4);
+	if (indexOffset < blobs_start(version) || indexOffset >= size)
+		return false;
+	return parse_index_block(data + indexOffset, size - indexOffset, blobs_start(version), indexOffset, version, out);
+}
+
+// the thumbnail as it sits in the summary, still deflated
+struct PackedThumbnail {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<unsigned char> packed;
+};
+
+// block is the summary, available how much of it was read
+bool parse_summary(const unsigned char* block, size_t available, CanvasFileSummary& out, PackedThumbnail* thumbnail) {
+	ByteReader in = { block, block + available };
+	uint32_t size = in.u32();
+	uint32_t checksum = in.u32();
+	if (!in.ok || size < SUMMARY_BODY_HEAD_SIZE || size > CANVAS_FILE_SUMMARY_SIZE - SUMMARY_HEAD_SIZE || size > in.left())
+		return false;
+	if (fnv1a(in.p, size) != checksum)
+		return false;
+
+	ByteReader body = { in.p, in.p + size };
+	uint32_t width       = body.u32();
+	uint32_t height      = body.u32();
+	uint32_t layerCount  = body.u32();
+	uint32_t listed      = body.u32();
+	uint32_t thumbWidth  = body.u32();
+	uint32_t thumbHeight = body.u32();
+	uint32_t thumbSize   = body.u32();
+	if (width == 0 || height == 0 || width > MAX_SIDE || height > MAX_SIDE || listed > layerCount)
+		return false;
+	if (thumbWidth > CANVAS_FILE_THUMBNAIL_SIZE || thumbHeight > CANVAS_FILE_THUMBNAIL_SIZE)
+		return false;
+	if ((uint64_t)listed * SUMMARY_LAYER_SIZE + thumbSize > body.left())
+		return false;
+
+	out.width = (int)width;
+	out.height = (int)height;
+	out.layerCount = layerCount;
+	read_layers(body, listed, out.layers);
+	const unsigned char* p = body.take(thumbSize);
+
+	out.thumbnail = CanvasFilePreview();
+	if (thumbWidth && thumbHeight) {
+		std::vector<unsigned char> pixels((size_t)thumbWidth * thumbHeight * 4);
+		if (!InflateExact(p, thumbSize, pixels.data(), pixels.size()))
+			return false;
+		out.thumbnail.width = (int)thumbWidth;
+		out.thumbnail.height = (int)thumbHeight;
+		out.thumbnail.pixels = std::move(pixels);
+		if (thumbnail) {
+			thumbnail->width = thumbWidth;
+			thumbnail->height = thumbHeight;
+			thumbnail->packed.assign(p, p + thumbSize);
+		}
+	}
+	return true;
+}
+
+// unpacks one blob into its spot in a width*height layer buffer
+bool decode_tile(const unsigned char* data, const CanvasFileIndex& index, const CanvasFileTile& tile, unsigned char* pixels) {
+	// v1 stores the whole layer as a single blob
+	if (index.tileSize == 0) {
+		// straight into the layer, a short blob leaves the rest zero
+		return Inflate(data + tile.offset, tile.size, pixels, (size_t)index.width * index.height * 4) >= 0;
+	}
+
+	uint32_t x = tile.tileX * index.tileSize;
+	uint32_t y = tile.tileY * index.tileSize;
+	uint32_t w = std::min((uint32_t)index.tileSize, (uint32_t)index.width - x);
+	uint32_t h = std::min((uint32_t)index.tileSize, (uint32_t)index.height - y);
+	return DecodeTile(tile.codec, data + tile.offset, tile.size, (int)w, (int)h,
+			pixels + ((size_t)y * index.width + x) * 4, (size_t)index.width * 4);
+}
+
+}
+
+bool ReadCanvasFileIndex(const unsigned char* data, size_t size, CanvasFileIndex& out) {
+	if (size >= 8 && memcmp(data, CANVAS_FILE_MAGIC, 4) == 0) {
+		uint32_t version = get_u32(data + 4);
+		if (version >= 4)
+			return version <= CANVAS_FILE_VERSION && index_v4(data, size, out);
+		return index_tiled(data, size, out);
+	}
+	return index_v1(data, size, out);
+}
+
+bool ParseCanvasFileSummary(const unsigned char* data, size_t size, CanvasFileSummary& out) {
+	if (size < HEADER_SIZE_V4 || memcmp(data, CANVAS_FILE_MAGIC, 4) != 0)
+		return false;
+	if (get_u32(data + 4) != CANVAS_FILE_VERSION)
+		return false;
+	return parse_summary(data + HEADER_SIZE_V4, size - HEADER_SIZE_V4, out, nullptr);
+}
+
+bool ReadCanvasFileSummary(const std::string& path, CanvasFileSummary& out) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+		return false;
+	std::vector<unsigned char> head(HEADER_SIZE_V4 + CANVAS_FILE_SUMMARY_SIZE);
+	file.read((char*)head.data(), head.size());
+	return ParseCanvasFileSummary(head.data(), (size_t)file.gcount(), out);
+}
+
+bool DecodeCanvasLayer(const unsigned char* data, const CanvasFileIndex& index, size_t layer, std::vector<unsigned char>& pixels) {
+	if (layer >= index.tiles.size())
+		return false;
+
+	const std::vector<CanvasFileTile>& tiles = index.tiles[layer];
+	pixels.assign((size_t)index.width * index.height * 4, 0);
+
+	std::atomic<bool> failed{false};
+	SharedPool().ParallelFor(tiles.size(), [&](size_t i) {
+		if (!decode_tile(data, index, tiles[i], pixels.data()))
+			failed = true;
+	});
+	return !failed;
+}
+
+bool DecodeCanvasPreview(const unsigned char* data, const CanvasFileIndex& index, size_t level, CanvasFilePreview& out) {
+	if (level >= index.previews.size())
+		return false;
+
+	const CanvasFileTile& entry = index.previews[level];
+	std::vector<unsigned char> pixels((size_t)entry.tileX * entry.tileY * 4);
+	if (!InflateExact(data + entry.offset, entry.size, pixels.data(), pixels.size()))
+		return false;
+	out.width = (int)entry.tileX;
+	out.height = (int)entry.tileY;
+	out.pixels = std::move(pixels);
+	return true;
+}
+
+void BuildCanvasPreviews(const unsigned char* pixels, int width, int height, std::vector<CanvasFilePreview>& out) {
+	out.clear();
+	const unsigned char* src = pixels;
+	int sw = width;
+	int sh = height;
+	for (int level = 0; level < CANVAS_FILE_PREVIEW_LEVELS; ++level) {
+		CanvasFilePreview preview;
+		preview.width = std::max(1, (sw + 1) / 2);
+		preview.height = std::max(1, (sh + 1) / 2);
+		preview.pixels.resize((size_t)preview.width * preview.height * 4);
+
+		for (int y = 0; y < preview.height; ++y) {
+			int y0 = std::min(y * 2, sh - 1);
+			int y1 = std::min(y * 2 + 1, sh - 1);
+			for (int x = 0; x < preview.width; ++x) {
+				int x0 = std::min(x * 2, sw - 1);
+				int x1 = std::min(x * 2 + 1, sw - 1);
+				const unsigned char* a = src + ((size_t)y0 * sw + x0) * 4;
+				const unsigned char* b = src + ((size_t)y0 * sw + x1) * 4;
+				const unsigned char* c = src + ((size_t)y1 * sw + x0) * 4;
+				const unsigned char* d = src + ((size_t)y1 * sw + x1) * 4;
+				unsigned char* o = preview.pixels.data() + ((size_t)y * preview.width + x) * 4;
+				for (int ch = 0; ch < 4; ++ch)
+					o[ch] = (unsigned char)((a[ch] + b[ch] + c[ch] + d[ch] + 2) / 4);
+			}
+		}
+
+		out.push_back(std::move(preview));
+		src = out.back().pixels.data();
+		sw = out.back().width;
+		sh = out.back().height;
+	}
+}
+
+bool UpdateCanvasPreviews(const unsigned char* pixels, int x, int y, int w, int h,
+		int width, int height, std::vector<CanvasFilePreview>& previews)
+{
+	const int step = 1 << CANVAS_FILE_PREVIEW_LEVELS;
+	if (previews.size() != CANVAS_FILE_PREVIEW_LEVELS || w <= 0 || h <= 0
+			|| x < 0 || y < 0 || x + w > width || y + h > height
+			|| x % step || y % step
+			|| ((x + w) % step && x + w != width) || ((y + h) % step && y + h != height))
+		return false;
+	for (int level = 0; level < CANVAS_FILE_PREVIEW_LEVELS; ++level) {
+		int shift = level + 1;
+		if (previews[level].width != std::max(1, (width + (1 << shift) - 1) >> shift)
+				|| previews[level].height != std::max(1, (height + (1 << shift) - 1) >> shift))
+			return false;
+	}
+
+	// aligned like that, every preview pixel of the region only sees
+	// region pixels, and one clamped at the region's edge is one clamped
+	// at the image's
+	std::vector<CanvasFilePreview> patch;
+	BuildCanvasPreviews(pixels, w, h, patch);
+	for (int level = 0; level < CANVAS_FILE_PREVIEW_LEVELS; ++level) {
+		const CanvasFilePreview& src = patch[level];
+		CanvasFilePreview& dst = previews[level];
+		int dx = x >> (level + 1);
+		int dy = y >> (level + 1);
+		for (int row = 0; row < src.height; ++row)
+			std::memcpy(dst.pixels.data() + ((size_t)(dy + row) * dst.width + dx) * 4,
+					src.pixels.data() + (size_t)row * src.width * 4, (size_t)src.width * 4);
+	}
+	return true;
+}
+
+bool LoadCanvasFile(const std::string& path, CanvasFileData& out) {
+	// mapped rather than read in, tiles inflate straight out of the page
+	// cache and nothing holds a second copy of the file
+	MappedFile file;
+	if (!file.Open(path) || file.Size() == 0)
+		return false;
+	const unsigned char* buf = file.Data();
+
+	CanvasFileIndex index;
+	if (!ReadCanvasFileIndex(buf, file.Size(), index))
+		return false;
+
+	out.width = index.width;
+	out.height = index.height;
+	out.colors = std::move(index.colors);
+	out.layers = std::move(index.layers);
+	for (CanvasFileLayer& layer : out.layers)
+		layer.pixels.assign((size_t)out.width * out.height * 4, 0);
+
+	// flatten every tile of every layer into one job list, each lands in
+	// its own rectangle so they can inflate side by side
+	std::vector<const CanvasFileTile*> jobs;
+	for (const std::vector<CanvasFileTile>& tiles : index.tiles)
+		for (const CanvasFileTile& tile : tiles)
+			jobs.push_back(&tile);
+
+	std::unique_ptr<std::atomic<bool>[]> failed(new std::atomic<bool>[out.layers.size()]());
+	SharedPool().ParallelFor(jobs.size(), [&](size_t i) {
+		const CanvasFileTile& tile = *jobs[i];
+		if (!decode_tile(buf, index, tile, out.layers[tile.layer].pixels.data()))
+			failed[tile.layer] = true;
+	});
+
+	if (index.version == 1) {
+		// layers that didn't inflate were skipped by the old loader too
+		size_t kept = 0;
+		for (size_t i = 0; i < out.layers.size(); ++i) {
+			if (failed[i])
+				continue;
+			if (kept != i)
+				out.layers[kept] = std::move(out.layers[i]);
+			kept++;
+		}
+		out.layers.resize(kept);
+		return true;
+	}
+	for (size_t i = 0; i < out.layers.size(); ++i)
+		if (failed[i])
+			return false;
+	return true;
+}
+
+namespace {
+
+struct TileJob {
+	uint32_t layer;
+	int tx, ty;
+	bool empty;
+	std::vector<unsigned char> packed;
+};
+
+// Packs tiles across the pool a batch at a time and writes them in
+// job order, so the output doesn't depend on which worker finished
+// first. Batching keeps only a slice of the compressed file in memory.
+bool write_tiles(std::ostream& file, const CanvasFileData& data, std::vector<TileJob>& jobs, uint64_t& offset,
+		std::vector<CanvasFileTile>& toc, const std::function<void(float)>& progress)
+{
+	ThreadPool& pool = SharedPool();
+	const size_t batchSize = (pool.Size() + 1) * 16;
+
+	for (size_t start = 0; start < jobs.size(); start += batchSize) {
+		size_t count = std::min(batchSize, jobs.size() - start);
+
+		pool.ParallelFor(count, [&](size_t i) {
+			TileJob& job = jobs[start + i];
+			const CanvasFileLayer& layer = data.layers[job.layer];
+			int x = job.tx * CANVAS_FILE_TILE_SIZE;
+			int y = job.ty * CANVAS_FILE_TILE_SIZE;
+			int w = std::min(CANVAS_FILE_TILE_SIZE, data.width - x);
+			int h = std::min(CANVAS_FILE_TILE_SIZE, data.height - y);
+			if (tile_is_empty(layer, data.width, x, y, w, h))
+				return;
+
+			std::vector<unsigned char> tile((size_t)w * h * 4);
+			for (int row = 0; row < h; ++row)
+				memcpy(tile.data() + (size_t)row * w * 4, layer.pixels.data() + ((size_t)(y + row) * data.width + x) * 4, (size_t)w * 4);
+
+			job.empty = false;
+			if (!EncodeTile(data.codec, tile.data(), w, h, job.packed))
+				job.packed.clear();
+		});
+
+		for (size_t i = start; i < start + count; ++i) {
+			TileJob& job = jobs[i];
+			if (job.empty)
+				continue;
+			if (job.packed.empty())
+				return false;
+			file.write((const char*)job.packed.data(), job.packed.size());
+			toc.push_back(CanvasFileTile{ job.layer, (uint32_t)job.tx, (uint32_t)job.ty, offset, (uint32_t)job.packed.size(), (uint8_t)data.codec });
+			offset += job.packed.size();
+			std::vector<unsigned char>().swap(job.packed);
+		}
+		if (progress)
+			progress((float)(start + count) / jobs.size());
+	}
+	return true;
+}
+
+bool write_previews(std::ostream& file, const CanvasFileData& data, uint64_t& offset, std::vector<CanvasFileTile>& entries) {
+	std::vector<std::vector<unsigned char>> packed(data.previews.size());
+	SharedPool().ParallelFor(data.previews.size(), [&](size_t i) {
+		const CanvasFilePreview& preview = data.previews[i];
+		int size = 0;
+		unsigned char* blob = CompressData(preview.pixels.data(), (int)preview.pixels.size(), &size);
+		if (blob)
+			packed[i].assign(blob, blob + size);
+		MemFree(blob);
+	});
+
+	for (size_t i = 0; i < packed.size(); ++i) {
+		if (packed[i].empty())
+			return false;
+		file.write((const char*)packed[i].data(), packed[i].size());
+		entries.push_back(CanvasFileTile{ (uint32_t)i, (uint32_t)data.previews[i].width, (uint32_t)data.previews[i].height, offset, (uint32_t)packed[i].size() });
+		offset += packed[i].size();
+	}
+	return true;
+}
+
+std::vector<unsigned char> build_index(const CanvasFileData& data, const std::vector<CanvasFileTile>& previews, const std::vector<CanvasFileTile>& toc) {
+	std::vector<unsigned char> out;
+	put_u32(out, (uint32_t)data.width);
+	put_u32(out, (uint32_t)data.height);
+	put_u32(out, CANVAS_FILE_TILE_SIZE);
+	put_u32(out, (uint32_t)data.layers.size());
+	put_u32(out, (uint32_t)data.colors.size());
+	put_u32(out, (uint32_t)previews.size());
+	put_u32(out, (uint32_t)toc.size());
+
+	for (Color c : data.colors) {
+		out.push_back(c.r);
+		out.push_back(c.g);
+		out.push_back(c.b);
+	}
+	for (const CanvasFileLayer& layer : data.layers) {
+		out.push_back(layer.opacity);
+		out.insert(out.end(), 3, 0);
+		put_u32(out, (uint32_t)layer.blendMode);
+	}
+	for (const CanvasFileTile& entry : previews) {
+		put_u32(out, entry.tileX);
+		put_u32(out, entry.tileY);
+		put_u64(out, entry.offset);
+		put_u32(out, entry.size);
+	}
+	for (const CanvasFileTile& entry : toc) {
+		put_u32(out, entry.layer);
+		put_u32(out, entry.tileX);
+		put_u32(out, entry.tileY);
+		put_u64(out, entry.offset);
+		put_u32(out, entry.size);
+		out.push_back(entry.codec);
+		out.insert(out.end(), 3, 0);
+	}
+	return out;
+}
+
+// Shrinks the preview closest above the target to fit maxSide, box
+// filtered, and deflates it. Never scales up.
+bool pack_thumbnail(const std::vector<CanvasFilePreview>& previews, int maxSide, PackedThumbnail& out) {
+	out = PackedThumbnail();
+	if (previews.empty())
+		return false;
+
+	const CanvasFilePreview* source = &previews.front();
+	for (const CanvasFilePreview& preview : previews)
+		if (std::max(preview.width, preview.height) >= maxSide)
+			source = &preview;
+
+	int sw = source->width, sh = source->height;
+	float scale = std::min(1.0f, (float)maxSide / std::max(sw, sh));
+	int dw = std::max(1, (int)(sw * scale));
+	int dh = std::max(1, (int)(sh * scale));
+
+	std::vector<unsigned char> pixels((size_t)dw * dh * 4);
+	for (int y = 0; y < dh; ++y) {
+		int y0 = y * sh / dh, y1 = std::max(y0 + 1, (y + 1) * sh / dh);
+		for (int x = 0; x < dw; ++x) {
+			int x0 = x * sw / dw, x1 = std::max(x0 + 1, (x + 1) * sw / dw);
+			unsigned sum[4] = {};
+			for (int sy = y0; sy < y1; ++sy)
+				for (int sx = x0; sx < x1; ++sx)
+					for (int c = 0; c < 4; ++c)
+						sum[c] += source->pixels[((size_t)sy * sw + sx) * 4 + c];
+			unsigned count = (unsigned)((y1 - y0) * (x1 - x0));
+			for (int c = 0; c < 4; ++c)
+				pixels[((size_t)y * dw + x) * 4 + c] = (unsigned char)((sum[c] + count / 2) / count);
+		}
+	}
+
+	int size = 0;
+	unsigned char* packed = CompressData(pixels.data(), (int)pixels.size(), &size);
+	if (!packed)
+		return false;
+	out.width = (uint32_t)dw;
+	out.height = (uint32_t)dh;
+	out.packed.assign(packed, packed + size);
+	MemFree(packed);
+	return true;
+}
+
+const size_t SUMMARY_ROOM = CANVAS_FILE_SUMMARY_SIZE - SUMMARY_HEAD_SIZE - SUMMARY_BODY_HEAD_SIZE;
+
+size_t listed_layers(const CanvasFileData& data) {
+	return std::min(data.layers.size(), SUMMARY_ROOM / SUMMARY_LAYER_SIZE);
+}
+
+// the whole reserved block, padding included. Layers past what fits are
+// left out of the list, the thumbnail is dropped if it doesn't fit next
+// to them.
+std::vector<unsigned char> build_summary(const CanvasFileData& data, const PackedThumbnail& thumbnail) {
+	size_t listed = listed_layers(data);
+	bool withThumbnail = thumbnail.packed.size() <= SUMMARY_ROOM - listed * SUMMARY_LAYER_SIZE;
+
+	std::vector<unsigned char> body;
+	put_u32(body, (uint32_t)data.width);
+	put_u32(body, (uint32_t)data.height);
+	put_u32(body, (uint32_t)data.layers.size());
+	put_u32(body, (uint32_t)listed);
+	put_u32(body, withThumbnail ? thumbnail.width : 0);
+	put_u32(body, withThumbnail ? thumbnail.height : 0);
+	put_u32(body, withThumbnail ? (uint32_t)thumbnail.packed.size() : 0);
+	for (size_t i = 0; i < listed; ++i) {
+		body.push_back(data.layers[i].opacity);
+		body.insert(body.end(), 3, 0);
+		put_u32(body, (uint32_t)data.layers[i].blendMode);
+	}
+	if (withThumbnail)
+		body.insert(body.end(), thumbnail.packed.begin(), thumbnail.packed.end());
+
+	std::vector<unsigned char> block;
+	put_u32(block, (uint32_t)body.size());
+	put_u32(block, fnv1a(body.data(), body.size()));
+	block.insert(block.end(), body.begin(), body.end());
+	block.resize(CANVAS_FILE_SUMMARY_SIZE, 0);
+	return block;
+}
+
+// halves the thumbnail until it fits, most canvases never need to
+std::vector<unsigned char> summary_for(const CanvasFileData& data) {
+	PackedThumbnail thumbnail;
+	size_t room = SUMMARY_ROOM - listed_layers(data) * SUMMARY_LAYER_SIZE;
+	for (int side = CANVAS_FILE_THUMBNAIL_SIZE; side >= 16; side /= 2)
+		if (pack_thumbnail(data.previews, side, thumbnail) && thumbnail.packed.size() <= room)
+			break;
+	return build_summary(data, thumbnail);
+}
+
+// flush() only hands the bytes to the OS, this waits for the disk. Any
+// handle will do, so the streams don't need to expose theirs.
+bool sync_file(const std::string& path) {
+#if defined(_WIN32)
+	HANDLE h = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (h == INVALID_HANDLE_VALUE)
+		return false;
+	bool ok = FlushFileBuffers(h) != 0;
+	CloseHandle(h);
+	return ok;
+#else
+	int fd = open(path.c_str(), O_WRONLY);
+	if (fd < 0)
+		return false;
+#if defined(__linux__)
+	bool ok = fdatasync(fd) == 0;
+#else
+	bool ok = fsync(fd) == 0;
+#endif
+	close(fd);
+	return ok;
+#endif
+}
+
+// so a rename into it survives a crash, nothing to do on Windows
+bool sync_directory(const std::string& path) {
+#if defined(_WIN32)
+	(void)path;
+	return true;
+#else
+	std::string dir = std::filesystem::path(path).parent_path().string();
+	int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	bool ok = fsync(fd) == 0;
+	close(fd);
+	return ok;
+#endif
+}
+
+// The index goes at the end, and only once it's fully on disk does the
+// header start pointing at it. With a path both halves are synced, so a
+// power cut can't get the header there before what it points at.
+bool finish_file(std::ostream& file, const std::string& syncPath, const std::vector<unsigned char>& index, uint64_t offset) {
+	file.seekp(offset);
+	file.write((const char*)index.data(), index.size());
+	file.flush();
+	if (!file.good())
+		return false;
+	if (!syncPath.empty() && !sync_file(syncPath))
+		return false;
+
+	std::vector<unsigned char> indexOffset;
+	put_u64(indexOffset, offset);
+	file.seekp(8);
+	file.write((const char*)indexOffset.data(), indexOffset.size());
+	file.flush();
+	if (!file.good())
+		return false;
+	return syncPath.empty() || sync_file(syncPath);
+}
+
+uint64_t live_bytes(const std::vector<CanvasFileTile>& previews, const std::vector<CanvasFileTile>& toc, size_t indexSize) {
+	uint64_t total = blobs_start(CANVAS_FILE_VERSION) + indexSize;
+	for (const CanvasFileTile& entry : previews)
+		total += entry.size;
+	for (const CanvasFileTile& entry : toc)
+		total += entry.size;
+	return total;
+}
+
+bool write_full(std::ostream& file, const CanvasFileData& data, const std::function<void(float)>& progress, CanvasFileSpace* space) {
+	std::vector<unsigned char> head;
+	head.insert(head.end(), CANVAS_FILE_MAGIC, CANVAS_FILE_MAGIC + 4);
+	put_u32(head, CANVAS_FILE_VERSION);
+	put_u64(head, 0);  // index offset, patched at the end
+	file.write((const char*)head.data(), head.size());
+
+	std::vector<unsigned char> summary = summary_for(data);
+	file.write((const char*)summary.data(), summary.size());
+
+	uint64_t offset = head.size() + summary.size();
+	std::vector<CanvasFileTile> previews;
+	if (!write_previews(file, data, offset, previews))
+		return false;
+
+	std::vector<TileJob> jobs;
+	int tilesX = (data.width  + CANVAS_FILE_TILE_SIZE - 1) / CANVAS_FILE_TILE_SIZE;
+	int tilesY = (data.height + CANVAS_FILE_TILE_SIZE - 1) / CANVAS_FILE_TILE_SIZE;
+	for (size_t l = 0; l < data.layers.size(); ++l)
+		for (int ty = 0; ty < tilesY; ++ty)
+			for (int tx = 0; tx < tilesX; ++tx)
+				jobs.push_back(TileJob{ (uint32_t)l, tx, ty, true, {} });
+
+	std::vector<CanvasFileTile> toc;
+	if (!write_tiles(file, data, jobs, offset, toc, progress))
+		return false;
+
+	// a full save goes to a temp file, the rename is what makes it count
+	std::vector<unsigned char> index = build_index(data, previews, toc);
+	if (!finish_file(file, std::string(), index, offset))
+		return false;
+
+	if (space) {
+		space->fileBytes = offset + index.size();
+		space->liveBytes = live_bytes(previews, toc, index.size());
+	}
+	return true;
+}
+
+}
+
+bool SaveCanvasFile(const std::string& path, const CanvasFileData& data, const std::function<void(float)>& progress, CanvasFileSpace* space) {
+	std::string tmpPath = path + ".tmp";
+	bool ok;
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return false;
+		ok = write_full(file, data, progress, space);
+		file.close();
+		ok = ok && !file.fail();
+	}
+
+	// the temp file has to be on disk before it replaces the last good save
+	ok = ok && sync_file(tmpPath);
+
+	std::error_code err;
+	if (ok)
+		std::filesystem::rename(tmpPath, path, err);
+	if (!ok || err) {
+		std::filesystem::remove(tmpPath, err);
+		return false;
+	}
+	// the new file's there either way, this only makes the rename stick
+	sync_directory(path);
+	return true;
+}
+
+bool AppendCanvasFile(const std::string& path, const CanvasFileData& data, const std::function<void(float)>& progress, CanvasFileSpace* space) {
+	std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+	if (!file.is_open())
+		return false;
+
+	unsigned char header[HEADER_SIZE_V4];
+	file.read((char*)header, sizeof(header));
+	if ((size_t)file.gcount() != sizeof(header) || memcmp(header, CANVAS_FILE_MAGIC, 4) != 0)
+		return false;
+	if (get_u32(header + 4) != CANVAS_FILE_VERSION)
+		return false;
+
+	uint64_t indexOffset = get_u64(header + 8);
+	file.seekg(0, std::ios::end);
+	uint64_t fileSize = (uint64_t)file.tellg();
+	if (indexOffset < blobs_start(CANVAS_FILE_VERSION) || indexOffset >= fileSize)
+		return false;
+
+	// kept in case this save has no previews to make a new thumbnail from
+	std::vector<unsigned char> oldSummary(CANVAS_FILE_SUMMARY_SIZE);
+	file.seekg(HEADER_SIZE_V4);
+	file.read((char*)oldSummary.data(), oldSummary.size());
+	CanvasFileSummary oldInfo;
+	PackedThumbnail oldThumbnail;
+	parse_summary(oldSummary.data(), (size_t)file.gcount(), oldInfo, &oldThumbnail);
+	file.clear();
+
+	std::vector<unsigned char> block((size_t)(fileSize - indexOffset));
+	file.seekg(indexOffset);
+	file.read((char*)block.data(), block.size());
+	if ((size_t)file.gcount() != block.size())
+		return false;
+
+	CanvasFileIndex old;
+	if (!parse_index_block(block.data(), block.size(), blobs_start(CANVAS_FILE_VERSION), indexOffset, CANVAS_FILE_VERSION, old))
+		return false;
+	if (old.width != data.width || old.height != data.height || old.tileSize != CANVAS_FILE_TILE_SIZE
+			|| old.layers.size() != data.layers.size())
+		return false;
+
+	int tilesX = (data.width  + CANVAS_FILE_TILE_SIZE - 1) / CANVAS_FILE_TILE_SIZE;
+	int tilesY = (data.height + CANVAS_FILE_TILE_SIZE - 1) / CANVAS_FILE_TILE_SIZE;
+	size_t tileCount = (size_t)tilesX * tilesY;
+
+	std::vector<TileJob> jobs;
+	std::vector<std::vector<bool>> rewritten(data.layers.size());
+	for (size_t l = 0; l < data.layers.size(); ++l) {
+		const CanvasFileLayer& layer = data.layers[l];
+		if (layer.pixels.empty())
+			continue;
+		rewritten[l].assign(tileCount, false);
+		for (size_t t = 0; t < tileCount; ++t) {
+			if (!layer.dirty.empty() && (t >= layer.dirty.size() || !layer.dirty[t]))
+				continue;
+			rewritten[l][t] = true;
+			jobs.push_back(TileJob{ (uint32_t)l, (int)(t % tilesX), (int)(t / tilesX), true, {} });
+		}
+	}
+
+	// new blobs go after everything that's there, the old index included
+	uint64_t offset = fileSize;
+	file.seekp(offset);
+
+	std::vector<CanvasFileTile> previews;
+	if (data.previews.empty())
+		previews = old.previews;
+	else if (!write_previews(file, data, offset, previews))
+		return false;
+
+	std::vector<CanvasFileTile> toc;
+	for (size_t l = 0; l < old.tiles.size(); ++l)
+		for (const CanvasFileTile& entry : old.tiles[l])
+			if (rewritten[l].empty() || !rewritten[l][(size_t)entry.tileY * tilesX + entry.tileX])
+				toc.push_back(entry);
+
+	if (!write_tiles(file, data, jobs, offset, toc, progress))
+		return false;
+
+	std::vector<unsigned char> index = build_index(data, previews, toc);
+	if (!finish_file(file, path, index, offset))
+		return false;
+
+	// the append is in by now, a summary torn from here on only costs
+	// the thumbnail
+	std::vector<unsigned char> summary = data.previews.empty() ? build_summary(data, oldThumbnail) : summary_for(data);
+	file.seekp(HEADER_SIZE_V4);
+	file.write((const char*)summary.data(), summary.size());
+	file.flush();
+
+	if (space) {
+		space->fileBytes = offset + index.size();
+		space->liveBytes = live_bytes(previews, toc, index.size());
+	}
+	return true;
+}
@@ -1,4 +1,6 @@
-#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
 #include <iostream>
 #include <vector>
 
@@ -8,82 +10,327 @@
 #include "rlgl.h"
 
 #include "canvas.h"
+#include "canvas_file.h"
+#include "helpers.h"
+#include "profiler.h"
 
 // misc
-void Canvas::save(){
+void Canvas::save(bool exportPng){
 	if (fileName == "") fileName = "myTemp.mc";
 
-	std::ofstream file(fileName, std::ios::binary);
-	if (!file.is_open()) return;
-
-	file << width << " " << height << " " << layers.size() << "\n";
-	// save colors too
-	file << colorQueue.size() << '\n';
-	for(auto c : colorQueue){
-		file << (int)c.r << " " << (int)c.g << " " << (int)c.b << '\n';
+	if (saver.Busy()) {
+		bus.pushEvent((Event){
+			.type = EVENT_NOTIFY,
+			.notify_message = "Still saving..."
+		});
+		return;
 	}
-	file << '\n';
-	for (auto& l : layers) {
-		int compressedSize = 0;
-
-		unsigned char opacity = (unsigned char)l.opacity;
-		int blendMode = (int)l.blendingMode;
-
-		Image img = LoadImageFromTexture(l.tex.texture);
-		Color* colors = LoadImageColors(img);
-		unsigned char* compressedData =
-			CompressData((unsigned char*)colors,
-					(img.width * img.height) * sizeof(Color),
-					&compressedSize);
 
-		file << (int)opacity << " "
-			<< blendMode << " "
-			<< compressedSize << "\n";
+	// anything still sitting in the opened file has to be on the GPU to be
+	// read back, and the mapping has to go before the file is replaced
+	materialize_all();
+
+	CanvasFileData data;
+	data.width = width;
+	data.height = height;
+	data.colors = colorQueue;
+	data.codec = tileCodec;
+
+	// Enter only adds the tiles that changed to the end of the file,
+	// Shift+Enter and anything can_append() turns down rewrite it whole
+	bool append = !exportPng && can_append();
+
+	// the readbacks are the snapshot, anything drawn after this doesn't
+	// end up in the file
+	std::vector<Readback> reads;
+	for (size_t i = 0; i < layers.size(); ++i) {
+		Layer& l = layers[i];
+		CanvasFileLayer layer;
+		layer.opacity = l.opacity;
+		layer.blendMode = (int)l.blendingMode;
+
+		if (!append) {
+			reads.emplace_back(l.tex);
+		} else if (dirty.Any(DIRTY_SAVE, i)) {
+			layer.dirty = dirty.Tiles(DIRTY_SAVE, i);
+			reads.emplace_back(l.tex);
+		} else {
+			reads.emplace_back();
+		}
+		data.layers.push_back(std::move(layer));
+	}
+	reset_dirty();
+	savingLayers = layer_meta();
+
+	std::string pngPath = "";
+	if (exportPng)
+		pngPath = std::string(GetFileNameWithoutExt(fileName.c_str())) + (exportFormat == EXPORT_QOI ? ".qoi" : ".png");
+	PNG_LEVEL pngLevel = exportFormat == EXPORT_PNG_FAST ? PNG_FAST : PNG_DEFAULT;
+
+	// An append only reads the dirty layers, so the GPU flattens what its
+	// previews need. The saver keeps the last save's previews, then that's
+	// just the part that changed since, rounded out to whole preview
+	// pixels at the coarsest level. A full save flattens on the CPU.
+	Readback compositeRead;
+	DirtyRect region;
+	if (append && saver.HasPreviews(fileName, width, height)) {
+		DirtyRect changed = dirty.Bounds(DIRTY_PREVIEW, 0, layers.size());
+		if (!changed.Empty()) {
+			int step = 1 << CANVAS_FILE_PREVIEW_LEVELS;
+			int top = height - changed.y - changed.h;
+			region.x = changed.x / step * step;
+			region.y = top / step * step;
+			region.w = std::min((changed.x + changed.w + step - 1) / step * step, width) - region.x;
+			region.h = std::min((top + changed.h + step - 1) / step * step, height) - region.y;
+			compositeRead = read_composite(region);
+		}
+	} else if (append) {
+		compositeRead = read_composite(DirtyRect{ 0, 0, width, height });
+	}
+	dirty.Clear(DIRTY_PREVIEW);
+	saver.Start(fileName, std::move(data), std::move(reads), std::move(compositeRead), region, pngPath, append, pngLevel);
+}
 
-		file.write((char*)compressedData, compressedSize);
+void Canvas::update_saving(){
+	SaveResult result;
+	if (saver.Poll(&result))
+		report_save(result);
+}
 
-		file << "\n";
+void Canvas::report_save(const SaveResult& result){
+	// dirty flags were reset when the save started, so after a failure
+	// only a full rewrite is safe
+	if (result.path == fileName) {
+		if (result.ok) {
+			remember_saved(result.path, result.layerCount, result.space);
+
+			// the journal is covered by the file now, only what changed
+			// after the save's snapshot has to go into the next one
+			journalBase = result.space.fileBytes;
+			autosave.Discard(journalBase);
+			dirty.Copy(DIRTY_SAVE, DIRTY_JOURNAL);
+			journaledLayers = savingLayers;
+		} else {
+			savedFile.valid = false;
+		}
+	}
 
-		MemFree(compressedData);
-		UnloadImageColors(colors);
-		UnloadImage(img);
+	if (!result.ok) {
+		bus.pushEvent((Event){
+			.type = EVENT_NOTIFY,
+			.notify_message = TextFormat("Couldn't save %s", result.path.c_str())
+		});
+		return;
 	}
 
 	bus.pushEvent((Event){
 		.type = EVENT_NOTIFY,
-		.notify_message = TextFormat("Saved %s!", fileName.c_str())
+		.notify_message = TextFormat("Saved %s!", result.path.c_str())
 	});
+	if (result.exportedPng) {
+		bus.pushEvent((Event){
+			.type = EVENT_NOTIFY,
+			.notify_message = TextFormat("Saved to %s", result.pngPath.c_str())
+		});
+	}
+}
 
+void Canvas::remember_saved(const std::string& path, size_t layerCount, const CanvasFileSpace& space){
+	std::error_code err;
+	savedFile.path = path;
+	savedFile.layerCount = layerCount;
+	savedFile.space = space;
+	savedFile.modified = std::filesystem::last_write_time(path, err);
+	savedFile.valid = !err;
 }
 
-void Canvas::save_to_png(){
-	RenderTexture finalTex = LoadRenderTexture(width, height);
-	BeginTextureMode(finalTex);
-	ClearBackground(BLANK);
+bool Canvas::can_append(){
+	if (!savedFile.valid || savedFile.path != fileName || savedFile.layerCount != layers.size())
+		return false;
+
+	// someone else wrote to the file since
+	std::error_code err;
+	uint64_t size = std::filesystem::file_size(fileName, err);
+	if (err || size != savedFile.space.fileBytes)
+		return false;
+	if (std::filesystem::last_write_time(fileName, err) != savedFile.modified || err)
+		return false;
 
-	for(auto& l : layers) {
-		BeginBlendMode(l.blendingMode);
+	// compact once more than half of the file is replaced tiles
+	return savedFile.space.fileBytes <= 2 * savedFile.space.liveBytes;
+}
+
+// x/y/w/h in texture space, like everything that gets written to the file
+void Canvas::mark_dirty(size_t layer, int x, int y, int w, int h){
+	if (layer >= layers.size())
+		return;
+	dirty.Mark(layer, x, y, w, h);
+}
 
-		Rectangle source = { 0, 0, (float)width, (float)height};
-		Rectangle dest = { 0, 0,   (float)width,  (float)height};
+void Canvas::mark_layer_dirty(size_t layer){
+	mark_dirty(layer, 0, 0, width, height);
+}
 
-		DrawTexturePro(l.tex.texture, source, dest, (Vector2){0, 0}, 0.0f, Color{255,255,255,(unsigned char)l.opacity});
+void Canvas::reset_dirty(){
+	dirty.Clear(DIRTY_SAVE);
+}
 
-		EndBlendMode();
+std::vector<CanvasFileLayer> Canvas::layer_meta(){
+	std::vector<CanvasFileLayer> out;
+	for (auto& l : layers) {
+		CanvasFileLayer layer;
+		layer.opacity = l.opacity;
+		layer.blendMode = (int)l.blendingMode;
+		out.push_back(std::move(layer));
 	}
+	return out;
+}
 
-	EndTextureMode();
-	Image finalImage = LoadImageFromTexture(finalTex.texture);
-	std::string finalFilePath = std::string(GetFileNameWithoutExt(fileName.c_str())) + ".png";
-	ExportImage(finalImage, finalFilePath.c_str());
+// autosave
+std::string Canvas::journal_path(){
+	return (fileName.empty() ? std::string("myTemp.mc") : fileName) + ".journal";
+}
+
+// A journal left behind by a crash is offered for replay if it was
+// written on top of what just got loaded, a file of the same size or,
+// with a base of 0, a fresh canvas.
+void Canvas::check_journal(bool loaded){
+	dirty.Clear(DIRTY_JOURNAL);
+	journaledLayers = layer_meta();
+	lastAutosave = GetTime();
+
+	std::string path = journal_path();
+	std::error_code err;
+	journalBase = loaded ? std::filesystem::file_size(fileName, err) : 0;
+	if (err)
+		journalBase = 0;
+
+	Journal journal;
+	if (ReadJournal(path, journal, true)) {
+		if (journal.width == width && journal.height == height && journal.baseBytes == journalBase) {
+			pendingJournal = path;
+			return;
+		}
+		std::filesystem::remove(path, err);
+	}
+	autosave.Open(path, width, height, journalBase);
+}
+
+void Canvas::replay_journal(){
+	Journal journal;
+	if (!ReadJournal(pendingJournal, journal)) {
+		bus.pushEvent((Event){
+			.type = EVENT_NOTIFY,
+			.notify_message = TextFormat("Couldn't read %s", pendingJournal.c_str())
+		});
+		autosave.Open(pendingJournal, width, height, journalBase);
+		return;
+	}
+
+	std::vector<unsigned char> zeros;
+	for (const JournalRecord& record : journal.records) {
+		while (layers.size() < record.layers.size())
+			create_layer(false);
+		for (size_t i = 0; i < record.layers.size(); ++i) {
+			layers[i].opacity = record.layers[i].opacity;
+			layers[i].blendingMode = ValidLayerBlend(record.layers[i].blendMode);
+		}
+
+		for (const JournalTile& tile : record.tiles) {
+			materialize_layer(tile.layer);
+			int x = tile.tileX * CANVAS_FILE_TILE_SIZE;
+			int y = tile.tileY * CANVAS_FILE_TILE_SIZE;
+			int w = std::min(CANVAS_FILE_TILE_SIZE, width - x);
+			int h = std::min(CANVAS_FILE_TILE_SIZE, height - y);
+			const unsigned char* pixels = tile.pixels.data();
+			if (tile.pixels.empty()) {
+				zeros.assign((size_t)w * h * 4, 0);
+				pixels = zeros.data();
+			}
+			WriteTextureRegion(layers[tile.layer].tex, x, y, w, h, pixels);
+			mark_dirty(tile.layer, x, y, w, h);
+		}
+	}
 
+	// opacity and blend modes came back too
+	invalidate_composites();
+	for (size_t i = 0; i < layers.size(); ++i)
+		dirty.MarkLayer(i, DIRTY_BIT(DIRTY_PREVIEW));
+
+	// everything replayed is in the journal already, keep adding to it
+	dirty.Clear(DIRTY_JOURNAL);
+	journaledLayers = layer_meta();
+	autosave.Open(pendingJournal, width, height, journalBase, true);
 	bus.pushEvent((Event){
 		.type = EVENT_NOTIFY,
-		.notify_message = TextFormat("Saved to %s", finalFilePath.c_str())
+		.notify_message = TextFormat("Restored %d autosaves", (int)journal.records.size())
 	});
+}
+
+void Canvas::update_autosave(){
+	if (autosaveInterval <= 0.0)
+		return;
+
+	autosave.Update(layers, autosaveBudget);
+	if (autosave.Busy() || GetTime() - lastAutosave < autosaveInterval)
+		return;
+	lastAutosave = GetTime();
+
+	int tilesX = dirty.TilesX();
+	std::vector<JournalTileRef> tiles;
+	for (size_t i = 0; i < layers.size(); ++i) {
+		// a layer still in the file has nothing to read yet, it waits
+		if (!layers[i].Resident())
+			continue;
+		const std::vector<unsigned char>& changed = dirty.Tiles(DIRTY_JOURNAL, i);
+		for (size_t t = 0; t < changed.size(); ++t)
+			if (changed[t])
+				tiles.push_back(JournalTileRef{ i, (int)(t % tilesX), (int)(t / tilesX) });
+		dirty.ClearLayer(DIRTY_JOURNAL, i);
+	}
+
+	std::vector<CanvasFileLayer> meta = layer_meta();
+	bool metaChanged = meta.size() != journaledLayers.size();
+	for (size_t i = 0; !metaChanged && i < meta.size(); ++i)
+		metaChanged = meta[i].opacity != journaledLayers[i].opacity || meta[i].blendMode != journaledLayers[i].blendMode;
+	if (tiles.empty() && !metaChanged)
+		return;
+
+	journaledLayers = meta;
+	autosave.Begin(std::move(meta), std::move(tiles));
+}
+
+void Canvas::FinishSaving(){
+	SaveResult result;
+	if (saver.Finish(&result))
+		report_save(result);
+}
 
-	UnloadImage(finalImage);
+// region in image space, the copy out comes out upside down so the read
+// is in image row order
+Readback Canvas::read_composite(DirtyRect region){
+	std::vector<GpuLayer> flattened;
+	for (auto& l : layers)
+		if (l.Resident())
+			flattened.push_back(GpuLayer{ l.tex.texture, l.opacity, l.blendingMode });
+
+	Rectangle source = { (float)region.x, (float)(height - region.y - region.h), (float)region.w, (float)region.h };
+	DirtyRect texRegion = { region.x, height - region.y - region.h, region.w, region.h };
+	const Texture2D& flat = compositor.Flatten(nullptr, BLANK, flattened.data(), flattened.size(), width, height, texRegion);
+
+	RenderTexture finalTex = LoadRenderTexture(region.w, region.h);
+	BeginTextureMode(finalTex);
+	rlSetBlendFactors(RL_ONE, RL_ZERO, RL_FUNC_ADD);
+	BeginBlendMode(BLEND_CUSTOM);
+	Rectangle dest = { 0, 0, (float)region.w, (float)region.h };
+	DrawTexturePro(flat, source, dest, (Vector2){0, 0}, 0.0f, WHITE);
+	EndBlendMode();
+	EndTextureMode();
+
+	// the read is queued ahead of the delete, so the texture can go now
+	Readback read(finalTex);
 	UnloadRenderTexture(finalTex);
+	return read;
 }
 
 bool Canvas::load(std::string fileName) {
@@ -91,67 +338,165 @@ bool Canvas::load(std::string fileName) {
 		fileName = "myTemp.mc";
 		return false;
 	}
+	return open_stream(fileName);
+}
+
+// Maps the file and builds the layer list from its index. The coarsest
+// preview goes up right away, finer ones and then the layers decode in
+// the background and get swapped in by stream_layers().
+bool Canvas::open_stream(std::string fileName) {
+	materialize_all();
+	if (!stream.Open(fileName))
+		return false;
+
+	const CanvasFileIndex& index = stream.Index();
+	this->width = index.width;
+	this->height = index.height;
+
+	// older versions get rewritten whole on the first save
+	if (index.version == CANVAS_FILE_VERSION) {
+		CanvasFileSpace space;
+		std::error_code err;
+		space.fileBytes = std::filesystem::file_size(fileName, err);
+		space.liveBytes = index.liveBytes;
+		if (!err)
+			remember_saved(fileName, index.layers.size(), space);
+	}
+	SetWindowSize(width, height);
+	colorQueue.insert(colorQueue.end(), index.colors.begin(), index.colors.end());
+
+	for (size_t i = 0; i < index.layers.size(); ++i) {
+		layers.emplace_back(width, height, false, true);
+		Layer& l = layers.back();
+		l.opacity = index.layers[i].opacity;
+		l.blendingMode = ValidLayerBlend(index.layers[i].blendMode);
+		l.source = (int)i;
+	}
 
-	std::ifstream file(fileName, std::ios::binary);
-	if (file.is_open()) {
-		int w, h, layerCount;
-		std::string header;
-		if (!std::getline(file, header)){} else
-		{
-			if (sscanf(header.c_str(), "%d %d %d", &w, &h, &layerCount) == 3) {
-				this->width = w;
-				this->height = h;
-				SetWindowSize(w, h);
-				int colorCount;
-				std::string clrc;
-				std::getline(file, clrc);
-				sscanf(clrc.c_str(), "%d", &colorCount);
-				for(size_t i = 0; i < colorCount; ++i){
-					std::string meta;
-					if (!std::getline(file, meta)) break;
-
-					int red, green, blue;
-					sscanf(meta.c_str(), "%d %d %d", &red, &green, &blue);
-					Color clr = {(unsigned char)red, (unsigned char)green, (unsigned char)blue, 255};
-					colorQueue.push_back(clr);
-				}
-				file.ignore(1, '\n'); 
-				
+	size_t levels = index.previews.size();
+	if (levels > 0) {
+		CanvasFilePreview coarsest;
+		if (stream.DecodePreview(levels - 1, coarsest))
+			show_preview(coarsest.pixels.data(), coarsest.width, coarsest.height, (int)levels - 1);
+		for (size_t level = levels - 1; level-- > 0;)
+			stream.RequestPreview(level);
+	}
+
+	// with -l hidden layers stay in the file until they're edited or saved
+	for (size_t i = 0; i < layers.size(); ++i)
+		if (!lazyLoad || layers[i].opacity > 0)
+			stream.RequestLayer(layers[i].source);
 
-				for (int i = 0; i < layerCount; i++) {
-					std::string meta;
-					if (!std::getline(file, meta)) break;
+	finish_stream();
+	return true;
+}
 
-					int opacityInt, blendMode, compressedSize;
-					sscanf(meta.c_str(), "%d %d %d", &opacityInt, &blendMode, &compressedSize);
+void Canvas::show_preview(const unsigned char* pixels, int w, int h, int level) {
+	Image img = {};
+	img.data = (void*)pixels;
+	img.width = w;
+	img.height = h;
+	img.mipmaps = 1;
+	img.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+
+	drop_preview();
+	preview = LoadTextureFromImage(img);
+	SetTextureFilter(preview, TEXTURE_FILTER_BILINEAR);
+	previewLevel = level;
+}
 
-					std::vector<unsigned char> compressedBuffer(compressedSize);
-					file.read((char*)compressedBuffer.data(), compressedSize);
+void Canvas::drop_preview() {
+	if (preview.id != 0)
+		UnloadTexture(preview);
+	preview = {};
+	previewLevel = -1;
+}
 
-					file.ignore(1, '\n'); 
+void Canvas::upload_layer(size_t index, bool ok, const std::vector<unsigned char>& pixels) {
+	Layer& l = layers[index];
+	l.Allocate(false);
+	l.source = -1;
+	dirty.MarkLayer(index, DIRTY_BIT(DIRTY_COMPOSITE));
+	if (ok) {
+		ProfileScope profile(PROFILE_TRANSFERS);
+		UpdateTexture(l.tex.texture, pixels.data());
+	} else {
+		bus.pushEvent((Event){
+			.type = EVENT_NOTIFY,
+			.notify_message = TextFormat("Couldn't read layer %d", (int)index)
+		});
+	}
+}
 
-					int decompressedSize = 0;
-					unsigned char* decompressed = DecompressData(compressedBuffer.data(), compressedSize, &decompressedSize);
+// the preview goes once everything it stands in for is on screen, the
+// mapping once nothing is left in the file
+void Canvas::finish_stream() {
+	bool visibleLoaded = true;
+	bool allLoaded = true;
+	for (auto& l : layers) {
+		if (l.Resident())
+			continue;
+		allLoaded = false;
+		if (l.opacity > 0)
+			visibleLoaded = false;
+	}
+	if (visibleLoaded)
+		drop_preview();
+	if (allLoaded && stream.IsOpen())
+		stream.Close();
+}
 
-					if (decompressed) {
-						create_layer(false);
-						Layer& l = layers.back();
-						l.opacity = (unsigned char)opacityInt;
-						l.blendingMode = (BlendMode)blendMode;
+void Canvas::materialize_layer(size_t index) {
+	if (index >= layers.size() || layers[index].Resident())
+		return;
 
-						UpdateTexture(l.tex.texture, decompressed);
-						MemFree(decompressed);
-					}
-				}
-				return true;
+	std::vector<unsigned char> pixels;
+	bool ok = stream.DecodeLayer(layers[index].source, pixels);
+	upload_layer(index, ok, pixels);
+
+	// something is being edited, show the real layers from here on
+	drop_preview();
+	finish_stream();
+}
+
+void Canvas::materialize_all() {
+	for (size_t i = 0; i < layers.size(); ++i)
+		materialize_layer(i);
+}
+
+void Canvas::stream_layers() {
+	if (!stream.IsOpen())
+		return;
+
+	// uploads are capped per frame so panning and zooming stay smooth
+	double start = GetTime();
+	StreamedItem item;
+	while (GetTime() - start < 0.008 && stream.Poll(item)) {
+		if (item.isPreview) {
+			if (item.ok && previewLevel > (int)item.index)
+				show_preview(item.pixels.data(), item.width, item.height, (int)item.index);
+			continue;
+		}
+		for (size_t i = 0; i < layers.size(); ++i) {
+			if (!layers[i].Resident() && layers[i].source == (int)item.index) {
+				upload_layer(i, item.ok, item.pixels);
+				break;
 			}
 		}
 	}
-	return false;
+	finish_stream();
 }
 
 void Canvas::handle_file_loading(){
-	if (load(fileName)) {
+	history.Clear();
+	strokeLog.Clear();
+	invalidate_composites();
+	saver.DropPreviews();
+	savedFile = SavedFileState{};
+	bool loaded = load(fileName);
+	dirty.Reset(width, height);
+	dirtyFlash.clear();
+	if (loaded) {
 		selectedLayer = layers.size() - 1;
 		clr = colorQueue[0];
 		SetWindowTitle(TextFormat("myCanvas | %s", fileName.c_str()));
@@ -169,6 +514,7 @@ void Canvas::handle_file_loading(){
 	else
 		clr = colorQueue[0];
 
+	check_journal(loaded);
 }
 
 void Canvas::handle_window(){
@@ -219,6 +565,13 @@ Layer& Canvas::get_current_layer() {
 }
 
 Color Canvas::pick_color(Vector2 v1){
+	// the layer copy shows up a frame or two after Alt goes down
+	if (currentLayerCache.data == nullptr) {
+		if (!colorPickRead.Ready())
+			return BLANK;
+		currentLayerCache = colorPickRead.ResolveImage();
+	}
+
 	Color clr;
 	int xpos = (int)(screen_to_canvas(v1).x);
 	int ypos = height - (int)(screen_to_canvas(v1).y) - 1;
@@ -264,21 +617,63 @@ Vector2 Canvas::screen_to_canvas(Vector2 pos) {
 }
 
 void Canvas::draw_line(Vector2 canvasFrom, Vector2 canvasTo) {
-    BeginTextureMode(layers[selectedLayer].tex);
+	materialize_layer(selectedLayer);
+    float r = (isBrush ? brushSize : eraserSize) * pressure;
 
-    if (!isBrush) {
-        rlSetBlendFactors(RL_ZERO, RL_ONE_MINUS_SRC_ALPHA, RL_SRC_ALPHA);
-        rlSetBlendMode(BLEND_CUSTOM);
-    }
+	// grab the pre-stroke pixels under this segment before touching them,
+	// flipped into texture rows
+	float pad = r + 2.0f;
+	int x0 = (int)floorf(fminf(canvasFrom.x, canvasTo.x) - pad);
+	int x1 = (int)ceilf(fmaxf(canvasFrom.x, canvasTo.x) + pad);
+	int y0 = (int)floorf(fminf(canvasFrom.y, canvasTo.y) - pad);
+	int y1 = (int)ceilf(fmaxf(canvasFrom.y, canvasTo.y) + pad);
+	mark_dirty(selectedLayer, x0, height - y1, x1 - x0, y1 - y0);
+	if (historyMode == HISTORY_STROKES)
+		strokeLog.AddSegment(canvasFrom, canvasTo, r);
+	else
+		history.CaptureRegion(layers[selectedLayer], x0, height - y1, x1 - x0, y1 - y0);
 
-    float r = (isBrush ? brushSize : eraserSize) * pressure;
-	DrawCircleV(canvasFrom, r, isBrush ? clr : WHITE);
-	DrawLineEx(canvasFrom, canvasTo, 2*r, isBrush ? clr : WHITE);
-	DrawCircleV(canvasTo, r, isBrush ? clr : WHITE);
+	DrawStrokeSegment(layers[selectedLayer].tex, canvasFrom, canvasTo, r, clr, isBrush);
+}
 
-	if(!isBrush)
-		rlSetBlendMode(BLEND_ALPHA);
-    EndTextureMode();
+bool Canvas::undo() {
+	if (historyMode == HISTORY_STROKES)
+		return strokeLog.Undo(layers);
+	return history.Undo(layers);
+}
+
+bool Canvas::redo() {
+	if (historyMode == HISTORY_STROKES)
+		return strokeLog.Redo(layers);
+	return history.Redo(layers);
+}
+
+// only the summary block is read, the file itself opens once confirmed
+void Canvas::load_dropped_summary() {
+	unload_dropped_summary();
+
+	CanvasFileSummary summary;
+	if (!ReadCanvasFileSummary(droppedFile, summary))
+		return;
+	droppedInfo = TextFormat("%dx%d, %zu layers", summary.width, summary.height, summary.layerCount);
+
+	if (summary.thumbnail.pixels.empty())
+		return;
+	Image img = {};
+	img.data = summary.thumbnail.pixels.data();
+	img.width = summary.thumbnail.width;
+	img.height = summary.thumbnail.height;
+	img.mipmaps = 1;
+	img.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+	droppedThumbnail = LoadTextureFromImage(img);
+	SetTextureFilter(droppedThumbnail, TEXTURE_FILTER_BILINEAR);
+}
+
+void Canvas::unload_dropped_summary() {
+	if (droppedThumbnail.id != 0)
+		UnloadTexture(droppedThumbnail);
+	droppedThumbnail = {};
+	droppedInfo = "";
 }
 
 Vector2 Canvas::GetMousePos(){
@@ -293,6 +688,7 @@ void Canvas::handle_dropped_files() {
 			if(IsFileExtension(droppedFile.c_str(), ".mc")) {
 				if(!isSaved) {
 					this->droppedFile = droppedFile;
+					load_dropped_summary();
 				}else {
 					fileName = droppedFile;
 					handle_file_loading();
@@ -9,41 +9,175 @@
 
 #include "canvas.h"
 #include "helpers.h"
+#include "profiler.h"
+
+void Canvas::invalidate_composites(){
+	belowValid = false;
+	aboveValid = false;
+}
+
+// The layers under the selection are flattened over the background into
+// an opaque texture, by the compositor like everything else, so that one
+// comes out the same as drawing them to the screen. Over it only alpha
+// layers fold together: kept premultiplied, the run comes down to one
+// over operation that lands within a step or two of drawing them in
+// turn. Every other mode reads what's below in ways that don't, so the
+// cache starts above the highest of those.
+//
+// A valid cache only redraws the box its own layers were marked in since
+// the last frame, the rest of the texture is left alone by the scissor.
+void Canvas::update_composites(){
+	if (selectedLayer != cachedSelected || layers.size() != cachedLayerCount)
+		invalidate_composites();
+	cachedSelected = selectedLayer;
+	cachedLayerCount = layers.size();
+
+	for (RenderTexture2D* cache : { &belowCache, &aboveCache }) {
+		if (cache->id != 0 && cache->texture.width == width && cache->texture.height == height)
+			continue;
+		if (cache->id != 0)
+			UnloadRenderTexture(*cache);
+		*cache = LoadRenderTexture(width, height);
+		invalidate_composites();
+	}
+
+	DirtyRect whole = { 0, 0, width, height };
+	DirtyRect belowRegion = belowValid ? dirty.Bounds(DIRTY_COMPOSITE, 0, selectedLayer) : whole;
+	if (!belowRegion.Empty()) {
+		std::vector<GpuLayer> below;
+		for (size_t i = 0; i < selectedLayer && i < layers.size(); ++i)
+			if (layers[i].Resident())
+				below.push_back(GpuLayer{ layers[i].tex.texture, layers[i].opacity, layers[i].blendingMode });
+		compositor.Flatten(nullptr, CANVAS_BACKGROUND, below.data(), below.size(), belowCache, belowRegion);
+		belowValid = true;
+	}
+
+	if (!aboveValid) {
+		aboveFrom = layers.size();
+		while (aboveFrom > selectedLayer + 1 && layers[aboveFrom - 1].blendingMode == LAYER_BLEND_ALPHA)
+			aboveFrom--;
+	}
+	DirtyRect aboveRegion = aboveValid ? dirty.Bounds(DIRTY_COMPOSITE, aboveFrom, layers.size()) : whole;
+	if (!aboveRegion.Empty()) {
+		Rectangle source = { 0, 0, (float)width, -(float)height };
+		Rectangle dest = { 0, 0, (float)width, (float)height };
+
+		// texture rows run bottom up like the framebuffer's, so the region
+		// goes to the scissor as it is
+		BeginTextureMode(aboveCache);
+		rlEnableScissorTest();
+		rlScissor(aboveRegion.x, aboveRegion.y, aboveRegion.w, aboveRegion.h);
+		ClearBackground(BLANK);
+		rlSetBlendFactorsSeparate(RL_SRC_ALPHA, RL_ONE_MINUS_SRC_ALPHA, RL_ONE, RL_ONE_MINUS_SRC_ALPHA, RL_FUNC_ADD, RL_FUNC_ADD);
+		BeginBlendMode(BLEND_CUSTOM_SEPARATE);
+		for (size_t i = aboveFrom; i < layers.size(); ++i)
+			if (layers[i].Resident())
+				DrawTexturePro(layers[i].tex.texture, source, dest, {0, 0}, 0.0f, Color{255, 255, 255, layers[i].opacity});
+		EndBlendMode();
+		rlDrawRenderBatchActive();
+		rlDisableScissorTest();
+		EndTextureMode();
+		aboveValid = true;
+	}
+
+	dirty.Clear(DIRTY_COMPOSITE);
+}
 
 void Canvas::render_layers(){
+	ProfileScope profile(PROFILE_LAYERS);
+	Vector2 screenCenter = { (float)GetScreenWidth() * 0.5f, (float)GetScreenHeight() * 0.5f };
+
+	Rectangle dest = {
+		screenCenter.x,
+		screenCenter.y,
+		(float)width * scale,
+		(float)height * scale
+	};
+
+	Vector2 origin = {
+		screenCenter.x - canvasPos.x,
+		screenCenter.y - canvasPos.y
+	};
+
+	// flattened stand-in while the file is still streaming in, it's
+	// stored top row first so no flip
+	if (preview.id != 0) {
+		Rectangle source = { 0, 0, (float)preview.width, (float)preview.height };
+		if (isMirror) source.width *= -1;
+		DrawTexturePro(preview, source, dest, origin, rotation * RAD2DEG, WHITE);
+		return;
+	}
+
+	if (layers.empty() || selectedLayer >= layers.size())
+		return;
+	update_composites();
+
+	// below cache, the layers from the selection up to aboveFrom and the
+	// above cache, one draw while they fit the compositor's units
+	std::vector<GpuLayer> drawn;
+	for (size_t i = selectedLayer; i < aboveFrom; ++i)
+		if (layers[i].Resident())
+			drawn.push_back(GpuLayer{ layers[i].tex.texture, layers[i].opacity, layers[i].blendingMode });
+	if (aboveFrom < layers.size())
+		drawn.push_back(GpuLayer{ aboveCache.texture, 255, GPU_BLEND_PREMULTIPLIED });
+
+	Rectangle source = { 0, 0, (float)width, -(float)height };
+	if (isMirror) source.width *= -1;
+	const Texture2D* base = selectedLayer > 0 ? &belowCache.texture : nullptr;
+	compositor.Draw(base, CANVAS_BACKGROUND, drawn.data(), drawn.size(), source, dest, origin, rotation * RAD2DEG);
+}
+
+// F3, every tile that changed flashes and fades out, on any layer
+void Canvas::render_dirty_overlay(){
+	int tilesX = dirty.TilesX();
+	int tilesY = dirty.TilesY();
+	dirtyFlash.resize((size_t)tilesX * tilesY, -1e9);
+
+	double now = GetTime();
+	for (size_t i = 0; i < layers.size(); ++i) {
+		const std::vector<unsigned char>& tiles = dirty.Tiles(DIRTY_OVERLAY, i);
+		for (size_t t = 0; t < tiles.size(); ++t)
+			if (tiles[t])
+				dirtyFlash[t] = now;
+	}
+	dirty.Clear(DIRTY_OVERLAY);
+
+	if (!showDirty)
+		return;
+
+	const float fade = (float)DIRTY_FLASH_SECONDS;
 	Vector2 screenCenter = { (float)GetScreenWidth() * 0.5f, (float)GetScreenHeight() * 0.5f };
-    for(auto& l : layers) {
-        BeginBlendMode(l.blendingMode);
-
-        Rectangle source = { 0, 0, (float)width, -(float)height };
-        if (isMirror) source.width *= -1;
-
-        Rectangle dest = {
-            screenCenter.x,
-            screenCenter.y,
-            (float)width * scale,
-            (float)height * scale
-        };
-
-        Vector2 origin = {
-            screenCenter.x - canvasPos.x,
-            screenCenter.y - canvasPos.y
-        };
-
-        DrawTexturePro(
-            l.tex.texture,
-            source,
-            dest,
-            origin,
-            rotation * RAD2DEG,
-            Color{255, 255, 255, (unsigned char)l.opacity}
-        );
-
-        EndBlendMode();
-    }
+	Vector2 origin = {
+		screenCenter.x - canvasPos.x,
+		screenCenter.y - canvasPos.y
+	};
+	for (int ty = 0; ty < tilesY; ++ty) {
+		for (int tx = 0; tx < tilesX; ++tx) {
+			float age = (float)(now - dirtyFlash[(size_t)ty * tilesX + tx]);
+			if (age >= fade)
+				continue;
+
+			// tiles are in texture space, rows bottom up
+			int x = tx * CANVAS_FILE_TILE_SIZE;
+			int y = ty * CANVAS_FILE_TILE_SIZE;
+			int w = std::min(CANVAS_FILE_TILE_SIZE, width - x);
+			int h = std::min(CANVAS_FILE_TILE_SIZE, height - y);
+			int ix = isMirror ? width - x - w : x;
+			int iy = height - y - h;
+
+			Rectangle rec = { screenCenter.x, screenCenter.y, w * scale, h * scale };
+			Vector2 offset = { origin.x - ix * scale, origin.y - iy * scale };
+			DrawRectanglePro(rec, offset, rotation * RAD2DEG, Fade(RED, 0.4f * (1.0f - age / fade)));
+		}
+	}
+
+	DrawTextContrast(TextFormat("Dirty: %d tiles to save, %d to autosave",
+				(int)dirty.Count(DIRTY_SAVE), (int)dirty.Count(DIRTY_JOURNAL)),
+			GetScreenWidth() - 420, 20, 20, RED);
 }
 
 void Canvas::render_color_picker(){
+	ProfileScope profile(PROFILE_COLOR_PICKER);
 
 	GuiColorPicker(colorPickerRec, "Colors", &clr);
 
@@ -103,6 +237,7 @@ void Canvas::render_color_picker(){
 }
 
 void Canvas::render_layer_ui(){
+	ProfileScope profile(PROFILE_LAYER_UI);
 	auto events = bus.getEvents();
 	for(auto event : events) {
 		if (event.type == EVENT_NOTIFY) {
@@ -119,12 +254,21 @@ void Canvas::render_layer_ui(){
 	for(int i = layers.size()-1, y = 0; i >= 0; i--, y++){
 		char blend = 'A';
 		switch(layers[i].blendingMode){
-			case BLEND_ADDITIVE:
+			case LAYER_BLEND_ADDITIVE:
 				blend = 'A';
 				break;
-			case BLEND_MULTIPLIED:
+			case LAYER_BLEND_MULTIPLIED:
 				blend = 'M';
 				break;
+			case LAYER_BLEND_SCREEN:
+				blend = 'S';
+				break;
+			case LAYER_BLEND_OVERLAY:
+				blend = 'O';
+				break;
+			case LAYER_BLEND_DARKEN:
+				blend = 'D';
+				break;
 			default:
 				blend = 'N';
 				break;
@@ -138,6 +282,26 @@ void Canvas::render_layer_ui(){
 	}else
 		DrawTextContrast(TextFormat("Mirrored: False"), 20, GetScreenHeight()-100.0f, 20, WHITE);
 
+	if (historyMode == HISTORY_STROKES) {
+		StrokeLogStats stats = strokeLog.Stats();
+		DrawTextContrast(TextFormat("History: %d strokes | %d keyframes, %.1f MB (%.1f KB of strokes)",
+					(int)stats.depth, (int)stats.keyframes, stats.keyframeBytes / 1048576.0f,
+					stats.commandBytes / 1024.0f),
+				20, GetScreenHeight()-80.0f, 20, WHITE);
+	} else {
+		HistoryStats stats = history.Stats();
+		DrawTextContrast(TextFormat("History: %d steps | %.1f MB held (%.1f MB raw, %.1f MB on disk, %.0f MB VRAM)",
+					(int)stats.depth, stats.heldBytes / 1048576.0f, stats.rawBytes / 1048576.0f,
+					stats.spilledBytes / 1048576.0f, stats.vramBytes / 1048576.0f),
+				20, GetScreenHeight()-80.0f, 20, WHITE);
+	}
+
+	if (saver.Busy()) {
+		float progress = saver.Progress();
+		Rectangle bar = { GetScreenWidth() - 260.0f, GetScreenHeight() - 40.0f, 200.0f, 20.0f };
+		GuiProgressBar(bar, "Saving", TextFormat("%d%%", (int)(progress * 100.0f)), &progress, 0.0f, 1.0f);
+	}
+
 	// messages drawing
 	messageQueue.erase(std::remove_if( 
 				messageQueue.begin(), messageQueue.end(), [](NotifMessage& msg) { return msg.lifeTime <= 0.0f; }
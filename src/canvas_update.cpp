@@ -2,6 +2,7 @@
 
 #include "canvas.h"
 #include "helpers.h"
+#include "profiler.h"
 #include "raylib.h"
 #include "raymath.h"
 
@@ -33,6 +34,7 @@ bool Canvas::handle_pen_events()
 }
 
 bool Canvas::handle_key_events(){
+	ProfileScope profile(PROFILE_KEYS);
 	bool ctrl  = IsKeyDown(KEY_LEFT_CONTROL);
 	bool shift = IsKeyDown(KEY_LEFT_SHIFT);
 	bool space = IsKeyDown(KEY_SPACE);
@@ -40,6 +42,10 @@ bool Canvas::handle_key_events(){
 
 	if(IsKeyPressed(KEY_TAB))
 		isUiHidden = !isUiHidden;
+	if(IsKeyPressed(KEY_F3))
+		showDirty = !showDirty;
+	if(IsKeyPressed(KEY_F2))
+		SharedProfiler().SetVisible(!SharedProfiler().Visible());
 
 	if (space && !ctrl && !shift) {
 		if (pointerPressed) {
@@ -115,23 +121,17 @@ bool Canvas::handle_key_events(){
 				
 				std::swap(layers[selectedLayer].width, layers[otherLayer].width);
 				std::swap(layers[selectedLayer].height, layers[otherLayer].height);
+				std::swap(layers[selectedLayer].source, layers[otherLayer].source);
+				history.SwapLayers(selectedLayer, otherLayer);
+				strokeLog.SwapLayers(selectedLayer, otherLayer);
+				mark_layer_dirty(selectedLayer);
+				mark_layer_dirty(otherLayer);
 
 				selectedLayer = otherLayer;
 			}
 		}
 		if (IsKeyPressed(KEY_Z)) {
-			if (!redo.empty()) {
-				size_t layerIdx = redo.front().first;
-				Image redoImage = redo.front().second;
-
-				Image current = LoadImageFromTexture(layers[layerIdx].tex.texture);
-				undo.push_front({layerIdx, current});
-
-				UpdateTexture(layers[layerIdx].tex.texture, redoImage.data);
-
-				UnloadImage(redoImage);
-				redo.pop_front();
-			}
+			redo();
 		}
 		return true;
 	}
@@ -141,8 +141,7 @@ bool Canvas::handle_key_events(){
 
 		if(IsKeyPressed(KEY_ENTER)){
 			SetWindowTitle(TextFormat("myCanvas | %s", fileName.c_str()));
-			save();
-			save_to_png();
+			save(true);
 		}
 
 		if(pointerDown){
@@ -186,7 +185,8 @@ bool Canvas::handle_key_events(){
 	}
 
 	if(IsKeyPressed(KEY_LEFT_ALT)){
-		currentLayerCache = LoadImageFromTexture(get_current_layer().tex.texture);
+		materialize_layer(selectedLayer);
+		colorPickRead = Readback(get_current_layer().tex);
 		isColorPicking = true;
 	}
 	if (alt && !ctrl && !space && !shift) {
@@ -202,7 +202,9 @@ bool Canvas::handle_key_events(){
 
 	if(IsKeyReleased(KEY_LEFT_ALT)){
 		isColorPicking = false;
+		colorPickRead = Readback();
 		UnloadImage(currentLayerCache);
+		currentLayerCache = {};
 	}
 
 	if (!IsKeyDown(KEY_LEFT_ALT)) {
@@ -225,19 +227,8 @@ bool Canvas::handle_key_events(){
 			}
 		}
 		if (IsKeyPressed(KEY_Z)) {
-			if (!undo.empty()) {
-				size_t layerIdx = undo.front().first;
-				Image prevImage = undo.front().second;
-
-				Image current = LoadImageFromTexture(layers[layerIdx].tex.texture);
-				redo.push_front({layerIdx, current});
-
-				UpdateTexture(layers[layerIdx].tex.texture, prevImage.data);
-
-				UnloadImage(prevImage); 
-				undo.pop_front();
+			if (undo())
 				mouseState = IDLE;
-			}
 			return true;
 		}
 		if(IsKeyPressed(KEY_ONE))
@@ -252,14 +243,17 @@ bool Canvas::handle_key_events(){
 			clr.a = transparency;
 
 		if(IsKeyPressed(KEY_D)){
-			layers[selectedLayer].blendingMode = (BlendMode)((layers[selectedLayer].blendingMode + 1) % 3);
+			layers[selectedLayer].blendingMode = (LAYER_BLEND)((layers[selectedLayer].blendingMode + 1) % LAYER_BLEND_COUNT);
 		}
 		if(IsKeyPressed(KEY_A)){
 			if(layers[selectedLayer].blendingMode == 0)
-				layers[selectedLayer].blendingMode = (BlendMode)(2);
+				layers[selectedLayer].blendingMode = (LAYER_BLEND)(LAYER_BLEND_COUNT - 1);
 			else
-				layers[selectedLayer].blendingMode = (BlendMode)(layers[selectedLayer].blendingMode - 1);
+				layers[selectedLayer].blendingMode = (LAYER_BLEND)(layers[selectedLayer].blendingMode - 1);
 		}
+		// the pixels didn't change but the flattened image did
+		if(IsKeyPressed(KEY_A) || IsKeyPressed(KEY_D))
+			dirty.MarkLayer(selectedLayer, DIRTY_BIT(DIRTY_PREVIEW));
 
 		return true;
 	}
@@ -268,6 +262,7 @@ bool Canvas::handle_key_events(){
 }
 
 bool Canvas::handle_tool_input(){
+	ProfileScope profile(PROFILE_TOOLS);
 
 	bool ctrl  = IsKeyDown(KEY_LEFT_CONTROL);
 	bool shift = IsKeyDown(KEY_LEFT_SHIFT);
@@ -286,9 +281,11 @@ bool Canvas::handle_tool_input(){
 		}
 		if(IsKeyPressed(KEY_A)){
 			layers[selectedLayer].opacity = (unsigned char)fmax(layers[selectedLayer].opacity - (255.0f/10.0f), 0.0f);
+			dirty.MarkLayer(selectedLayer, DIRTY_BIT(DIRTY_PREVIEW));
 			handled = true;
 		}else if (IsKeyPressed(KEY_D)){
 			layers[selectedLayer].opacity = (unsigned char)fmin(layers[selectedLayer].opacity + (255.0f/10.0f), 255.0f);
+			dirty.MarkLayer(selectedLayer, DIRTY_BIT(DIRTY_PREVIEW));
 			handled = true;
 		}
 		if(IsKeyPressed(KEY_E)){
@@ -339,18 +336,11 @@ bool Canvas::handle_tool_input(){
 
 			}
 
-			Image snapshot = LoadImageFromTexture(layers[selectedLayer].tex.texture);
-			undo.push_front({selectedLayer, snapshot});
-
-			if (undo.size() > 10) {
-				UnloadImage(undo.back().second);
-				undo.pop_back();
-			}
-
-			while (!redo.empty()) {
-				UnloadImage(redo.back().second);
-				redo.pop_back();
-			}
+			materialize_layer(selectedLayer);
+			if (historyMode == HISTORY_STROKES)
+				strokeLog.BeginStroke(layers[selectedLayer], selectedLayer, clr, isBrush ? brushSize : eraserSize, isBrush);
+			else
+				history.BeginStroke(layers[selectedLayer], selectedLayer);
 			handled = true;
 		}
 		if(pointerDown) {
@@ -375,6 +365,10 @@ bool Canvas::handle_tool_input(){
 					}
 				}
 			}
+			if (historyMode == HISTORY_STROKES)
+				strokeLog.EndStroke(layers[selectedLayer]);
+			else
+				history.EndStroke();
 			isColorPicking = false;
 			mouseState = IDLE;
 			prevMousePos = {-1,-1};
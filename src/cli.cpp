@@ -0,0 +1,514 @@
+#include <raylib.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "canvas_file.h"
+#include "compositor.h"
+#include "image_export.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "tile_codec.h"
+
+// mycanvas-cli: works on .mc files without opening a window, for scripts
+// and batch jobs
+
+void printUsage();
+int runStats(int argc, char** argv);
+int runFlatten(int argc, char** argv);
+int runExtract(int argc, char** argv);
+int runBatch(int argc, char** argv);
+int runBench(int argc, char** argv);
+int runThumbnail(int argc, char** argv);
+int runBenchParse(int argc, char** argv);
+int runBenchComposite(int argc, char** argv);
+
+int main(int argc, char** argv){
+	// raylib logs every export otherwise
+	SetTraceLogLevel(LOG_WARNING);
+
+	if (argc < 2) {
+		printUsage();
+		return 1;
+	}
+
+	if (strcmp(argv[1], "stats") == 0)
+		return runStats(argc - 2, argv + 2);
+	if (strcmp(argv[1], "flatten") == 0)
+		return runFlatten(argc - 2, argv + 2);
+	if (strcmp(argv[1], "extract") == 0)
+		return runExtract(argc - 2, argv + 2);
+	if (strcmp(argv[1], "batch") == 0)
+		return runBatch(argc - 2, argv + 2);
+	if (strcmp(argv[1], "bench") == 0)
+		return runBench(argc - 2, argv + 2);
+	if (strcmp(argv[1], "bench-parse") == 0)
+		return runBenchParse(argc - 2, argv + 2);
+	if (strcmp(argv[1], "bench-composite") == 0)
+		return runBenchComposite(argc - 2, argv + 2);
+	if (strcmp(argv[1], "thumbnail") == 0)
+		return runThumbnail(argc - 2, argv + 2);
+
+	printUsage();
+	return strcmp(argv[1], "--help") == 0 ? 0 : 1;
+}
+
+void printUsage(){
+	printf("Usage:\n");
+	printf("    ./mycanvas-cli stats <file.mc>...\n");
+	printf("    ./mycanvas-cli flatten [--fast] <file.mc> <out.png|out.qoi>\n");
+	printf("    ./mycanvas-cli extract <file.mc> <out prefix> [layer]  (writes <prefix>_<layer>.png)\n");
+	printf("    ./mycanvas-cli batch [-j <jobs>] [-f png|fast|qoi] <out dir> <file.mc>...\n");
+	printf("    ./mycanvas-cli bench <file.mc>...  (tile codecs, one core)\n");
+	printf("    ./mycanvas-cli bench-parse <file.mc>...  (index, summary and full load)\n");
+	printf("    ./mycanvas-cli bench-composite <file.mc>...  (every flatten kernel this CPU runs, against scalar)\n");
+	printf("    ./mycanvas-cli thumbnail <file.mc> <out.png|out.qoi>  (the embedded one, v6 files)\n");
+}
+
+bool flattenFile(const std::string& in, const std::string& out, PNG_LEVEL level, std::string& error){
+	CanvasFileData data;
+	if (!LoadCanvasFile(in, data)) {
+		error = "couldn't read " + in;
+		return false;
+	}
+
+	std::vector<CompositeLayer> layers;
+	for (const CanvasFileLayer& layer : data.layers)
+		layers.push_back(CompositeLayer{ layer.pixels.data(), layer.opacity, layer.blendMode });
+
+	std::vector<unsigned char> pixels((size_t)data.width * data.height * 4);
+	CompositeLayers(layers, data.width, data.height, pixels.data(), true);
+
+	if (!ExportPixels(out, pixels.data(), data.width, data.height, level)) {
+		error = "couldn't write " + out;
+		return false;
+	}
+	return true;
+}
+
+int runStats(int argc, char** argv){
+	if (argc < 1) {
+		printUsage();
+		return 1;
+	}
+
+	int failed = 0;
+	for (int i = 0; i < argc; ++i) {
+		MappedFile file;
+		CanvasFileIndex index;
+		if (!file.Open(argv[i]) || !ReadCanvasFileIndex(file.Data(), file.Size(), index)) {
+			fprintf(stderr, "%s: couldn't read\n", argv[i]);
+			failed++;
+			continue;
+		}
+
+		int tilesX = 1, tilesY = 1;
+		if (index.tileSize > 0) {
+			tilesX = (index.width  + index.tileSize - 1) / index.tileSize;
+			tilesY = (index.height + index.tileSize - 1) / index.tileSize;
+		}
+
+		printf("%s\n", argv[i]);
+		printf("    version      %d\n", index.version);
+		printf("    size         %dx%d\n", index.width, index.height);
+		printf("    tile size    %d\n", index.tileSize);
+		printf("    layers       %zu\n", index.layers.size());
+		printf("    colors       %zu\n", index.colors.size());
+		printf("    file bytes   %zu\n", file.Size());
+		if (index.version >= 4)
+			printf("    live bytes   %llu\n", (unsigned long long)index.liveBytes);
+
+		for (size_t l = 0; l < index.layers.size(); ++l) {
+			uint64_t bytes = 0;
+			for (const CanvasFileTile& tile : index.tiles[l])
+				bytes += tile.size;
+			size_t stored = index.tiles[l].size();
+			printf("    layer %-3zu   opacity %3d  blend %-8s  tiles %zu/%d (%.1f%%)  %llu bytes\n",
+					l, index.layers[l].opacity, LayerBlendName(index.layers[l].blendMode),
+					stored, tilesX * tilesY, 100.0 * stored / (tilesX * tilesY),
+					(unsigned long long)bytes);
+		}
+		size_t codecs[CANVAS_CODEC_COUNT] = {};
+		for (const std::vector<CanvasFileTile>& tiles : index.tiles)
+			for (const CanvasFileTile& tile : tiles)
+				codecs[tile.codec]++;
+		for (int codec = 0; codec < CANVAS_CODEC_COUNT; ++codec)
+			if (codecs[codec])
+				printf("    codec        %s, %zu tiles\n", CanvasCodecName(codec), codecs[codec]);
+		for (const CanvasFileTile& preview : index.previews)
+			printf("    preview      %ux%u  %u bytes\n", preview.tileX, preview.tileY, preview.size);
+
+		CanvasFileSummary summary;
+		if (ParseCanvasFileSummary(file.Data(), file.Size(), summary)) {
+			printf("    summary      %zu of %zu layers listed", summary.layers.size(), summary.layerCount);
+			if (!summary.thumbnail.pixels.empty())
+				printf(", thumbnail %dx%d", summary.thumbnail.width, summary.thumbnail.height);
+			printf("\n");
+		}
+	}
+	return failed ? 1 : 0;
+}
+
+int runFlatten(int argc, char** argv){
+	PNG_LEVEL level = PNG_DEFAULT;
+	if (argc > 0 && strcmp(argv[0], "--fast") == 0) {
+		level = PNG_FAST;
+		argc--;
+		argv++;
+	}
+	if (argc != 2) {
+		printUsage();
+		return 1;
+	}
+
+	std::string error;
+	if (!flattenFile(argv[0], argv[1], level, error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return 1;
+	}
+	return 0;
+}
+
+int runExtract(int argc, char** argv){
+	if (argc < 2 || argc > 3) {
+		printUsage();
+		return 1;
+	}
+
+	CanvasFileData data;
+	if (!LoadCanvasFile(argv[0], data)) {
+		fprintf(stderr, "couldn't read %s\n", argv[0]);
+		return 1;
+	}
+
+	size_t first = 0, last = data.layers.size();
+	if (argc == 3) {
+		first = (size_t)atoi(argv[2]);
+		last = first + 1;
+		if (first >= data.layers.size()) {
+			fprintf(stderr, "%s has %zu layers\n", argv[0], data.layers.size());
+			return 1;
+		}
+	}
+
+	// layers are stored bottom row first, images go top row first
+	size_t rowBytes = (size_t)data.width * 4;
+	std::vector<unsigned char> flipped(rowBytes * data.height);
+	int failed = 0;
+	for (size_t l = first; l < last; ++l) {
+		const std::vector<unsigned char>& pixels = data.layers[l].pixels;
+		for (int y = 0; y < data.height; ++y)
+			memcpy(flipped.data() + (size_t)(data.height - 1 - y) * rowBytes, pixels.data() + (size_t)y * rowBytes, rowBytes);
+
+		std::string out = std::string(argv[1]) + "_" + std::to_string(l) + ".png";
+		if (!ExportPixels(out, flipped.data(), data.width, data.height)) {
+			fprintf(stderr, "couldn't write %s\n", out.c_str());
+			failed++;
+		}
+	}
+	return failed ? 1 : 0;
+}
+
+// Files are spread over their own pool. Each one still decodes and
+// composites across SharedPool(), so a few jobs are enough to keep the
+// machine busy, and every job holds a whole canvas in memory.
+int runBatch(int argc, char** argv){
+	size_t jobs = std::min(4u, std::max(1u, std::thread::hardware_concurrency()));
+	std::string format = "png";
+
+	int i = 0;
+	for (; i < argc; ++i) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			jobs = (size_t)std::max(1, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			format = argv[++i];
+		} else {
+			break;
+		}
+	}
+	if (argc - i < 2 || (format != "png" && format != "fast" && format != "qoi")) {
+		printUsage();
+		return 1;
+	}
+
+	PNG_LEVEL level = format == "fast" ? PNG_FAST : PNG_DEFAULT;
+	std::string extension = format == "qoi" ? ".qoi" : ".png";
+
+	std::filesystem::path outDir = argv[i++];
+	std::error_code err;
+	std::filesystem::create_directories(outDir, err);
+
+	// a/canvas.mc and b/canvas.mc would both go to canvas.png, so stems
+	// that come up more than once get numbered, compared without case for
+	// the filesystems that ignore it
+	auto key = [](std::string name) {
+		std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)tolower(c); });
+		return name;
+	};
+	std::map<std::string, int> stems;
+	for (int k = i; k < argc; ++k)
+		stems[key(std::filesystem::path(argv[k]).stem().string())]++;
+
+	std::vector<std::pair<std::string, std::filesystem::path>> work;
+	std::set<std::string> taken;
+	std::map<std::string, int> seen;
+	int failed = 0;
+	for (; i < argc; ++i) {
+		std::string stem = std::filesystem::path(argv[i]).stem().string();
+		std::string name = stem;
+		if (stems[key(stem)] > 1)
+			name += "_" + std::to_string(++seen[key(stem)]);
+		if (!taken.insert(key(name)).second) {
+			fprintf(stderr, "%s: %s%s is already taken by another input\n", argv[i], name.c_str(), extension.c_str());
+			failed++;
+			continue;
+		}
+		work.push_back({ argv[i], outDir / (name + extension) });
+	}
+
+	std::mutex printLock;
+	{
+		ThreadPool pool(jobs);
+		for (const auto& item : work) {
+			std::string in = item.first;
+			std::filesystem::path out = item.second;
+			pool.Submit([&, in, out] {
+				std::string error;
+				bool ok = flattenFile(in, out.string(), level, error);
+
+				std::lock_guard<std::mutex> guard(printLock);
+				if (ok) {
+					printf("%s -> %s\n", in.c_str(), out.string().c_str());
+				} else {
+					fprintf(stderr, "%s\n", error.c_str());
+					failed++;
+				}
+			});
+		}
+		pool.Wait();
+	}
+	return failed ? 1 : 0;
+}
+
+// Every stored tile of every layer through each codec, one after the
+// other on this thread so the MB/s are per core. Speeds are raw pixel
+// bytes per second both ways.
+int runBench(int argc, char** argv){
+	if (argc < 1) {
+		printUsage();
+		return 1;
+	}
+
+	struct Tile {
+		int width, height;
+		std::vector<unsigned char> pixels;
+	};
+
+	int failed = 0;
+	for (int i = 0; i < argc; ++i) {
+		CanvasFileData data;
+		if (!LoadCanvasFile(argv[i], data)) {
+			fprintf(stderr, "%s: couldn't read\n", argv[i]);
+			failed++;
+			continue;
+		}
+
+		std::vector<Tile> tiles;
+		size_t rawBytes = 0;
+		for (const CanvasFileLayer& layer : data.layers) {
+			for (int y = 0; y < data.height; y += CANVAS_FILE_TILE_SIZE) {
+				for (int x = 0; x < data.width; x += CANVAS_FILE_TILE_SIZE) {
+					Tile tile;
+					tile.width = std::min(CANVAS_FILE_TILE_SIZE, data.width - x);
+					tile.height = std::min(CANVAS_FILE_TILE_SIZE, data.height - y);
+					size_t rowBytes = (size_t)tile.width * 4;
+					tile.pixels.resize(rowBytes * tile.height);
+					for (int row = 0; row < tile.height; ++row)
+						memcpy(tile.pixels.data() + row * rowBytes, layer.pixels.data() + ((size_t)(y + row) * data.width + x) * 4, rowBytes);
+					// saves skip empty tiles, so does this
+					if (std::find_if(tile.pixels.begin(), tile.pixels.end(), [](unsigned char c) { return c != 0; }) == tile.pixels.end())
+						continue;
+					rawBytes += tile.pixels.size();
+					tiles.push_back(std::move(tile));
+				}
+			}
+		}
+
+		printf("%s: %zu tiles, %.1f MB raw\n", argv[i], tiles.size(), rawBytes / 1e6);
+		if (tiles.empty())
+			continue;
+
+		for (int codec = 0; codec < CANVAS_CODEC_COUNT; ++codec) {
+			std::vector<std::vector<unsigned char>> packed(tiles.size());
+			size_t packedBytes = 0;
+			auto t0 = std::chrono::steady_clock::now();
+			for (size_t t = 0; t < tiles.size(); ++t) {
+				EncodeTile(codec, tiles[t].pixels.data(), tiles[t].width, tiles[t].height, packed[t]);
+				packedBytes += packed[t].size();
+			}
+			auto t1 = std::chrono::steady_clock::now();
+
+			bool match = true;
+			std::vector<unsigned char> out;
+			for (size_t t = 0; t < tiles.size(); ++t) {
+				out.resize(tiles[t].pixels.size());
+				if (!DecodeTile(codec, packed[t].data(), packed[t].size(), tiles[t].width, tiles[t].height, out.data(), (size_t)tiles[t].width * 4)
+						|| out != tiles[t].pixels)
+					match = false;
+			}
+			auto t2 = std::chrono::steady_clock::now();
+
+			double encodeSeconds = std::chrono::duration<double>(t1 - t0).count();
+			double decodeSeconds = std::chrono::duration<double>(t2 - t1).count();
+			printf("    %-13s %10zu bytes  ratio %6.2f  encode %8.1f MB/s  decode %8.1f MB/s%s\n",
+					CanvasCodecName(codec), packedBytes, (double)rawBytes / std::max((size_t)1, packedBytes),
+					rawBytes / 1e6 / std::max(encodeSeconds, 1e-9), rawBytes / 1e6 / std::max(decodeSeconds, 1e-9),
+					match ? "" : "  MISMATCH");
+			if (!match)
+				failed++;
+		}
+	}
+	return failed ? 1 : 0;
+}
+
+// reads the summary block and nothing past it
+int runThumbnail(int argc, char** argv){
+	if (argc != 2) {
+		printUsage();
+		return 1;
+	}
+
+	CanvasFileSummary summary;
+	if (!ReadCanvasFileSummary(argv[0], summary) || summary.thumbnail.pixels.empty()) {
+		fprintf(stderr, "%s has no thumbnail\n", argv[0]);
+		return 1;
+	}
+	if (!ExportPixels(argv[1], summary.thumbnail.pixels.data(), summary.thumbnail.width, summary.thumbnail.height)) {
+		fprintf(stderr, "couldn't write %s\n", argv[1]);
+		return 1;
+	}
+	return 0;
+}
+
+// runs f until a quarter second has gone by, returns seconds per run
+template <typename F>
+double timeRepeated(F f){
+	int runs = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	double seconds = 0;
+	do {
+		f();
+		runs++;
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	} while (seconds < 0.25);
+	return seconds / runs;
+}
+
+int runBenchParse(int argc, char** argv){
+	if (argc < 1) {
+		printUsage();
+		return 1;
+	}
+
+	int failed = 0;
+	for (int i = 0; i < argc; ++i) {
+		MappedFile file;
+		CanvasFileIndex index;
+		if (!file.Open(argv[i]) || !ReadCanvasFileIndex(file.Data(), file.Size(), index)) {
+			fprintf(stderr, "%s: couldn't read\n", argv[i]);
+			failed++;
+			continue;
+		}
+
+		size_t entries = index.previews.size();
+		for (const std::vector<CanvasFileTile>& tiles : index.tiles)
+			entries += tiles.size();
+		double indexSeconds = timeRepeated([&] {
+			CanvasFileIndex again;
+			ReadCanvasFileIndex(file.Data(), file.Size(), again);
+		});
+		printf("%s: %zu layers, %zu index entries\n", argv[i], index.layers.size(), entries);
+		printf("    index     %10.1f us  %8.1f M entries/s\n", indexSeconds * 1e6, entries / 1e6 / indexSeconds);
+
+		CanvasFileSummary summary;
+		if (ParseCanvasFileSummary(file.Data(), file.Size(), summary)) {
+			double summarySeconds = timeRepeated([&] {
+				CanvasFileSummary again;
+				ParseCanvasFileSummary(file.Data(), file.Size(), again);
+			});
+			printf("    summary   %10.1f us\n", summarySeconds * 1e6);
+		}
+
+		// the whole file, on every core, like opening it in the app
+		CanvasFileData data;
+		auto t0 = std::chrono::steady_clock::now();
+		bool loaded = LoadCanvasFile(argv[i], data);
+		double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		if (!loaded) {
+			fprintf(stderr, "%s: couldn't load\n", argv[i]);
+			failed++;
+			continue;
+		}
+		double pixelBytes = (double)data.width * data.height * 4 * data.layers.size();
+		printf("    load      %10.1f ms  %8.1f MB/s of file  %8.1f MB/s of pixels\n", loadSeconds * 1e3,
+				file.Size() / 1e6 / loadSeconds, pixelBytes / 1e6 / loadSeconds);
+	}
+	return failed ? 1 : 0;
+}
+
+// Flattens with every kernel the CPU can run, on every core like a save
+// does, and checks each against the scalar one. The SIMD kernels round
+// the same way, anything but 0 is a bug.
+int runBenchComposite(int argc, char** argv){
+	if (argc < 1) {
+		printUsage();
+		return 1;
+	}
+
+	COMPOSITE_KERNEL best = CompositeKernel();
+	int failed = 0;
+	for (int i = 0; i < argc; ++i) {
+		CanvasFileData data;
+		if (!LoadCanvasFile(argv[i], data)) {
+			fprintf(stderr, "%s: couldn't read\n", argv[i]);
+			failed++;
+			continue;
+		}
+
+		std::vector<CompositeLayer> layers;
+		for (const CanvasFileLayer& layer : data.layers)
+			layers.push_back(CompositeLayer{ layer.pixels.data(), layer.opacity, layer.blendMode });
+		size_t bytes = (size_t)data.width * data.height * 4;
+		printf("%s: %dx%d, %zu layers\n", argv[i], data.width, data.height, layers.size());
+
+		std::vector<unsigned char> reference(bytes), out(bytes);
+		for (int k = COMPOSITE_SCALAR; k <= (int)best; ++k) {
+			COMPOSITE_KERNEL kernel = (COMPOSITE_KERNEL)k;
+			ForceCompositeKernel(kernel);
+			std::vector<unsigned char>& target = kernel == COMPOSITE_SCALAR ? reference : out;
+			double seconds = timeRepeated([&] {
+				CompositeLayers(layers, data.width, data.height, target.data());
+			});
+
+			int maxDiff = 0;
+			for (size_t b = 0; b < bytes; ++b)
+				maxDiff = std::max(maxDiff, std::abs((int)target[b] - (int)reference[b]));
+			double pixels = (double)data.width * data.height * std::max((size_t)1, layers.size());
+			printf("    %-7s %10.2f ms  %8.1f M layer pixels/s  max diff %d\n", CompositeKernelName(kernel),
+					seconds * 1e3, pixels / 1e6 / seconds, maxDiff);
+			if (maxDiff != 0)
+				failed++;
+		}
+		ForceCompositeKernel(best);
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "compositor.h"
+#include "thread_pool.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define COMPOSITOR_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace {
+
+const int BAND_ROWS = 32;
+
+typedef void (*BlendRowFn)(unsigned char* dst, const unsigned char* src, int count, unsigned opacity, int mode);
+
+// x/255 rounded, exact for anything up to 255*255
+inline unsigned div255(unsigned x) {
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+// Per channel, with S the texel with its alpha scaled by the layer
+// opacity (sa), D what is below, both 0..255:
+//   alpha       (S*sa + D*(255 - sa)) / 255        GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA
+//   additive    S*sa/255 + D                       GL_SRC_ALPHA, GL_ONE
+//   multiplied  S*D/255 + D*(255 - sa)/255         GL_DST_COLOR, GL_ONE_MINUS_SRC_ALPHA
+// clamped to 255 like a unorm render target. Screen, overlay and darken
+// go like alpha with the color swapped for B(S, D) (see separable()),
+// which is what the shader does too. Every kernel below rounds the same
+// way, so they agree with each other bit for bit.
+inline unsigned separable(unsigned s, unsigned d, int mode) {
+	if (mode == LAYER_BLEND_SCREEN)
+		return s + d - div255(s * d);
+	// doubled after the divide, so the SIMD kernels stay within 16 bits
+	if (mode == LAYER_BLEND_OVERLAY)
+		return d < 128 ? 2 * div255(s * d) : 255 - 2 * div255((255 - s) * (255 - d));
+	if (mode == LAYER_BLEND_DARKEN)
+		return std::min(s, d);
+	return s;
+}
+
+void blend_row_scalar(unsigned char* dst, const unsigned char* src, int count, unsigned opacity, int mode) {
+	for (int i = 0; i < count; ++i, src += 4, dst += 4) {
+		unsigned sa = div255(src[3] * opacity);
+		unsigned inv = 255 - sa;
+		unsigned s[4] = { src[0], src[1], src[2], sa };
+		for (int c = 0; c < 4; ++c) {
+			unsigned d = dst[c];
+			unsigned v;
+			if (mode == LAYER_BLEND_ADDITIVE)
+				v = div255(s[c] * sa) + d;
+			else if (mode == LAYER_BLEND_MULTIPLIED)
+				v = div255(s[c] * d) + div255(d * inv);
+			else
+				v = div255((c < 3 ? separable(s[c], d, mode) : sa) * sa + d * inv);
+			dst[c] = (unsigned char)std::min(v, 255u);
+		}
+	}
+}
+
+#ifdef COMPOSITOR_X86
+
+TARGET_SSE2 inline __m128i div255_sse2(__m128i x) {
+	__m128i t = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// two pixels widened to 16 bits per channel
+TARGET_SSE2 inline __m128i blend_sse2(__m128i s, __m128i d, __m128i opacity, __m128i alphaLanes, int mode) {
+	__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	__m128i sa = div255_sse2(_mm_mullo_epi16(a, opacity));
+	__m128i inv = _mm_sub_epi16(_mm_set1_epi16(255), sa);
+	s = _mm_or_si128(_mm_andnot_si128(alphaLanes, s), _mm_and_si128(alphaLanes, sa));
+
+	if (mode == LAYER_BLEND_ADDITIVE)
+		return _mm_add_epi16(div255_sse2(_mm_mullo_epi16(s, sa)), d);
+	if (mode == LAYER_BLEND_MULTIPLIED)
+		return _mm_add_epi16(div255_sse2(_mm_mullo_epi16(s, d)), div255_sse2(_mm_mullo_epi16(d, inv)));
+	if (mode != LAYER_BLEND_ALPHA) {
+		__m128i b;
+		if (mode == LAYER_BLEND_SCREEN) {
+			b = _mm_sub_epi16(_mm_add_epi16(s, d), div255_sse2(_mm_mullo_epi16(s, d)));
+		} else if (mode == LAYER_BLEND_OVERLAY) {
+			const __m128i full = _mm_set1_epi16(255);
+			__m128i low = _mm_slli_epi16(div255_sse2(_mm_mullo_epi16(s, d)), 1);
+			__m128i high = _mm_sub_epi16(full,
+					_mm_slli_epi16(div255_sse2(_mm_mullo_epi16(_mm_sub_epi16(full, s), _mm_sub_epi16(full, d))), 1));
+			__m128i dark = _mm_cmplt_epi16(d, _mm_set1_epi16(128));
+			b = _mm_or_si128(_mm_and_si128(dark, low), _mm_andnot_si128(dark, high));
+		} else {
+			b = _mm_min_epi16(s, d);
+		}
+		s = _mm_or_si128(_mm_andnot_si128(alphaLanes, b), _mm_and_si128(alphaLanes, sa));
+	}
+	return div255_sse2(_mm_add_epi16(_mm_mullo_epi16(s, sa), _mm_mullo_epi16(d, inv)));
+}
+
+TARGET_SSE2 void blend_row_sse2(unsigned char* dst, const unsigned char* src, int count, unsigned opacity, int mode) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i op = _mm_set1_epi16((short)opacity);
+	const __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i*)(src + i * 4));
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst + i * 4));
+		__m128i lo = blend_sse2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero), op, alphaLanes, mode);
+		__m128i hi = blend_sse2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero), op, alphaLanes, mode);
+		// packus saturates, which is the clamp to 255
+		_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_packus_epi16(lo, hi));
+	}
+	blend_row_scalar(dst + i * 4, src + i * 4, count - i, opacity, mode);
+}
+
+TARGET_AVX2 inline __m256i div255_avx2(__m256i x) {
+	__m256i t = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+TARGET_AVX2 inline __m256i blend_avx2(__m256i s, __m256i d, __m256i opacity, __m256i alphaLanes, int mode) {
+	__m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	__m256i sa = div255_avx2(_mm256_mullo_epi16(a, opacity));
+	__m256i inv = _mm256_sub_epi16(_mm256_set1_epi16(255), sa);
+	s = _mm256_blendv_epi8(s, sa, alphaLanes);
+
+	if (mode == LAYER_BLEND_ADDITIVE)
+		return _mm256_add_epi16(div255_avx2(_mm256_mullo_epi16(s, sa)), d);
+	if (mode == LAYER_BLEND_MULTIPLIED)
+		return _mm256_add_epi16(div255_avx2(_mm256_mullo_epi16(s, d)), div255_avx2(_mm256_mullo_epi16(d, inv)));
+	if (mode != LAYER_BLEND_ALPHA) {
+		__m256i b;
+		if (mode == LAYER_BLEND_SCREEN) {
+			b = _mm256_sub_epi16(_mm256_add_epi16(s, d), div255_avx2(_mm256_mullo_epi16(s, d)));
+		} else if (mode == LAYER_BLEND_OVERLAY) {
+			const __m256i full = _mm256_set1_epi16(255);
+			__m256i low = _mm256_slli_epi16(div255_avx2(_mm256_mullo_epi16(s, d)), 1);
+			__m256i high = _mm256_sub_epi16(full,
+					_mm256_slli_epi16(div255_avx2(_mm256_mullo_epi16(_mm256_sub_epi16(full, s), _mm256_sub_epi16(full, d))), 1));
+			__m256i dark = _mm256_cmpgt_epi16(_mm256_set1_epi16(128), d);
+			b = _mm256_blendv_epi8(high, low, dark);
+		} else {
+			b = _mm256_min_epi16(s, d);
+		}
+		s = _mm256_blendv_epi8(b, sa, alphaLanes);
+	}
+	return div255_avx2(_mm256_add_epi16(_mm256_mullo_epi16(s, sa), _mm256_mullo_epi16(d, inv)));
+}
+
+// unpack and pack both work within 128-bit lanes, so the pixel order
+// comes back out the way it went in
+TARGET_AVX2 void blend_row_avx2(unsigned char* dst, const unsigned char* src, int count, unsigned opacity, int mode) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i op = _mm256_set1_epi16((short)opacity);
+	const __m256i alphaLanes = _mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0);
+
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i s = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+		__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i * 4));
+		__m256i lo = blend_avx2(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero), op, alphaLanes, mode);
+		__m256i hi = blend_avx2(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero), op, alphaLanes, mode);
+		_mm256_storeu_si256((__m256i*)(dst + i * 4), _mm256_packus_epi16(lo, hi));
+	}
+	blend_row_sse2(dst + i * 4, src + i * 4, count - i, opacity, mode);
+}
+
+#endif
+
+COMPOSITE_KERNEL detect_kernel() {
+#ifdef COMPOSITOR_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return COMPOSITE_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return COMPOSITE_SSE2;
+#endif
+	return COMPOSITE_SCALAR;
+}
+
+std::atomic<int> forcedKernel{-1};
+
+BlendRowFn row_function(COMPOSITE_KERNEL kernel) {
+	switch (kernel) {
+#ifdef COMPOSITOR_X86
+	case COMPOSITE_AVX2: return blend_row_avx2;
+	case COMPOSITE_SSE2: return blend_row_sse2;
+#endif
+	default: return blend_row_scalar;
+	}
+}
+
+}
+
+COMPOSITE_KERNEL CompositeKernel() {
+	static const COMPOSITE_KERNEL detected = detect_kernel();
+	int forced = forcedKernel;
+	// never hand out something this CPU can't run
+	if (forced >= 0 && forced <= (int)detected)
+		return (COMPOSITE_KERNEL)forced;
+	return detected;
+}
+
+void ForceCompositeKernel(COMPOSITE_KERNEL kernel) {
+	forcedKernel = (int)kernel;
+}
+
+LAYER_BLEND ValidLayerBlend(int mode) {
+	return mode >= 0 && mode < LAYER_BLEND_COUNT ? (LAYER_BLEND)mode : LAYER_BLEND_ALPHA;
+}
+
+const char* LayerBlendName(int mode) {
+	switch (mode) {
+	case LAYER_BLEND_ALPHA: return "normal";
+	case LAYER_BLEND_ADDITIVE: return "additive";
+	case LAYER_BLEND_MULTIPLIED: return "multiply";
+	case LAYER_BLEND_SCREEN: return "screen";
+	case LAYER_BLEND_OVERLAY: return "overlay";
+	case LAYER_BLEND_DARKEN: return "darken";
+	default: return "?";
+	}
+}
+
+const char* CompositeKernelName(COMPOSITE_KERNEL kernel) {
+	switch (kernel) {
+	case COMPOSITE_AVX2: return "avx2";
+	case COMPOSITE_SSE2: return "sse2";
+	default: return "scalar";
+	}
+}
+
+void CompositeLayers(const std::vector<CompositeLayer>& layers, int width, int height, unsigned char* out, bool flipRows) {
+	if (width <= 0 || height <= 0)
+		return;
+
+	BlendRowFn blend = row_function(CompositeKernel());
+	size_t rowBytes = (size_t)width * 4;
+	size_t bands = (height + BAND_ROWS - 1) / BAND_ROWS;
+
+	// each output row takes every layer in turn while it's still in cache
+	SharedPool().ParallelFor(bands, [&](size_t band) {
+		int y0 = (int)band * BAND_ROWS;
+		int y1 = std::min(height, y0 + BAND_ROWS);
+		for (int y = y0; y < y1; ++y) {
+			unsigned char* row = out + (size_t)(flipRows ? height - 1 - y : y) * rowBytes;
+			memset(row, 0, rowBytes);
+			for (const CompositeLayer& layer : layers) {
+				if (!layer.pixels)
+					continue;
+				blend(row, layer.pixels + (size_t)y * rowBytes, width, layer.opacity, ValidLayerBlend(layer.blendMode));
+			}
+		}
+	});
+}
@@ -0,0 +1,112 @@
+#include <algorithm>
+
+#include "canvas_file.h"
+#include "dirty_tracker.h"
+
+const std::vector<unsigned char> DirtyTracker::clean;
+
+void DirtyTracker::Reset(int width, int height) {
+	this->width = width;
+	this->height = height;
+	tilesX = (width  + CANVAS_FILE_TILE_SIZE - 1) / CANVAS_FILE_TILE_SIZE;
+	tilesY = (height + CANVAS_FILE_TILE_SIZE - 1) / CANVAS_FILE_TILE_SIZE;
+	for (Channel& channel : channels)
+		channel = Channel();
+}
+
+void DirtyTracker::Mark(size_t layer, int x, int y, int w, int h, unsigned mask) {
+	int x0 = std::max(x, 0), x1 = std::min(x + w, width);
+	int y0 = std::max(y, 0), y1 = std::min(y + h, height);
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	for (int c = 0; c < DIRTY_CHANNEL_COUNT; ++c) {
+		if (!(mask & DIRTY_BIT(c)))
+			continue;
+		Channel& channel = channels[c];
+		if (channel.tiles.size() <= layer) {
+			channel.tiles.resize(layer + 1);
+			channel.bounds.resize(layer + 1);
+		}
+
+		std::vector<unsigned char>& tiles = channel.tiles[layer];
+		if (tiles.empty())
+			tiles.assign((size_t)tilesX * tilesY, 0);
+		for (int ty = y0 / CANVAS_FILE_TILE_SIZE; ty <= (y1 - 1) / CANVAS_FILE_TILE_SIZE; ++ty)
+			for (int tx = x0 / CANVAS_FILE_TILE_SIZE; tx <= (x1 - 1) / CANVAS_FILE_TILE_SIZE; ++tx)
+				tiles[(size_t)ty * tilesX + tx] = 1;
+
+		DirtyRect& r = channel.bounds[layer];
+		if (r.Empty()) {
+			r = DirtyRect{ x0, y0, x1 - x0, y1 - y0 };
+		} else {
+			int rx1 = std::max(r.x + r.w, x1), ry1 = std::max(r.y + r.h, y1);
+			r.x = std::min(r.x, x0);
+			r.y = std::min(r.y, y0);
+			r.w = rx1 - r.x;
+			r.h = ry1 - r.y;
+		}
+	}
+}
+
+void DirtyTracker::MarkLayer(size_t layer, unsigned mask) {
+	Mark(layer, 0, 0, width, height, mask);
+}
+
+bool DirtyTracker::Any(DIRTY_CHANNEL channel, size_t layer) const {
+	const Channel& c = channels[channel];
+	return layer < c.bounds.size() && !c.bounds[layer].Empty();
+}
+
+const std::vector<unsigned char>& DirtyTracker::Tiles(DIRTY_CHANNEL channel, size_t layer) const {
+	const Channel& c = channels[channel];
+	return layer < c.tiles.size() ? c.tiles[layer] : clean;
+}
+
+DirtyRect DirtyTracker::Bounds(DIRTY_CHANNEL channel, size_t from, size_t to) const {
+	const Channel& c = channels[channel];
+	int x0 = width, y0 = height, x1 = 0, y1 = 0;
+	for (size_t i = from; i < to && i < c.bounds.size(); ++i) {
+		const DirtyRect& r = c.bounds[i];
+		if (r.Empty())
+			continue;
+		x0 = std::min(x0, r.x);
+		y0 = std::min(y0, r.y);
+		x1 = std::max(x1, r.x + r.w);
+		y1 = std::max(y1, r.y + r.h);
+	}
+	if (x0 >= x1 || y0 >= y1)
+		return DirtyRect();
+	return DirtyRect{ x0, y0, x1 - x0, y1 - y0 };
+}
+
+size_t DirtyTracker::Count(DIRTY_CHANNEL channel) const {
+	size_t count = 0;
+	for (const std::vector<unsigned char>& tiles : channels[channel].tiles)
+		count += std::count(tiles.begin(), tiles.end(), 1);
+	return count;
+}
+
+void DirtyTracker::Clear(DIRTY_CHANNEL channel) {
+	channels[channel] = Channel();
+}
+
+void DirtyTracker::ClearLayer(DIRTY_CHANNEL channel, size_t layer) {
+	Channel& c = channels[channel];
+	if (layer >= c.tiles.size())
+		return;
+	c.tiles[layer].clear();
+	c.bounds[layer] = DirtyRect();
+}
+
+void DirtyTracker::Copy(DIRTY_CHANNEL from, DIRTY_CHANNEL to) {
+	channels[to] = channels[from];
+}
+
+int DirtyTracker::TilesX() const {
+	return tilesX;
+}
+
+int DirtyTracker::TilesY() const {
+	return tilesY;
+}
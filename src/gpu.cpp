@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "gpu.h"
+#include "profiler.h"
+#include "rlgl.h"
+
+#if defined(_WIN32)
+#define GLAPIENTRY __stdcall
+#else
+#define GLAPIENTRY
+#endif
+
+#define GL_RGBA                       0x1908
+#define GL_UNSIGNED_BYTE              0x1401
+#define GL_COLOR_BUFFER_BIT           0x4000
+#define GL_PIXEL_PACK_BUFFER          0x88EB
+#define GL_STREAM_READ                0x88E1
+#define GL_MAP_READ_BIT               0x0001
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#define GL_SYNC_FLUSH_COMMANDS_BIT    0x0001
+#define GL_ALREADY_SIGNALED           0x911A
+#define GL_CONDITION_SATISFIED        0x911C
+#define GL_WAIT_FAILED                0x911D
+#define GL_MAX_TEXTURE_IMAGE_UNITS    0x8872
+#define GL_TIMESTAMP                  0x8E28
+#define GL_QUERY_RESULT               0x8866
+#define GL_QUERY_RESULT_AVAILABLE     0x8867
+
+namespace {
+	typedef void (GLAPIENTRY *ReadPixelsProc)(int x, int y, int w, int h, unsigned int format, unsigned int type, void* pixels);
+	typedef void (GLAPIENTRY *GenBuffersProc)(int n, unsigned int* buffers);
+	typedef void (GLAPIENTRY *DeleteBuffersProc)(int n, const unsigned int* buffers);
+	typedef void (GLAPIENTRY *BindBufferProc)(unsigned int target, unsigned int buffer);
+	typedef void (GLAPIENTRY *BufferDataProc)(unsigned int target, ptrdiff_t size, const void* data, unsigned int usage);
+	typedef void* (GLAPIENTRY *MapBufferRangeProc)(unsigned int target, ptrdiff_t offset, ptrdiff_t length, unsigned int access);
+	typedef unsigned char (GLAPIENTRY *UnmapBufferProc)(unsigned int target);
+	typedef void* (GLAPIENTRY *FenceSyncProc)(unsigned int condition, unsigned int flags);
+	typedef unsigned int (GLAPIENTRY *ClientWaitSyncProc)(void* sync, unsigned int flags, uint64_t timeout);
+	typedef void (GLAPIENTRY *DeleteSyncProc)(void* sync);
+	typedef void (GLAPIENTRY *GetIntegervProc)(unsigned int name, int* data);
+	typedef void (GLAPIENTRY *GenQueriesProc)(int n, unsigned int* ids);
+	typedef void (GLAPIENTRY *DeleteQueriesProc)(int n, const unsigned int* ids);
+	typedef void (GLAPIENTRY *QueryCounterProc)(unsigned int id, unsigned int target);
+	typedef void (GLAPIENTRY *GetQueryObjectivProc)(unsigned int id, unsigned int name, int* params);
+	typedef void (GLAPIENTRY *GetQueryObjectui64vProc)(unsigned int id, unsigned int name, uint64_t* params);
+
+	struct {
+		bool loaded = false;
+		bool hasPbo = false;
+		bool hasTimer = false;
+		ReadPixelsProc ReadPixels;
+		GenBuffersProc GenBuffers;
+		DeleteBuffersProc DeleteBuffers;
+		BindBufferProc BindBuffer;
+		BufferDataProc BufferData;
+		MapBufferRangeProc MapBufferRange;
+		UnmapBufferProc UnmapBuffer;
+		FenceSyncProc FenceSync;
+		ClientWaitSyncProc ClientWaitSync;
+		DeleteSyncProc DeleteSync;
+		GetIntegervProc GetIntegerv;
+		GenQueriesProc GenQueries;
+		DeleteQueriesProc DeleteQueries;
+		QueryCounterProc QueryCounter;
+		GetQueryObjectivProc GetQueryObjectiv;
+		GetQueryObjectui64vProc GetQueryObjectui64v;
+	} gl;
+
+	// spent timestamp queries, handed out again before new ones are made
+	std::vector<unsigned int> freeQueries;
+
+	void LoadProcs() {
+		if (gl.loaded)
+			return;
+		gl.loaded = true;
+
+		gl.ReadPixels     = (ReadPixelsProc)rlGetProcAddress("glReadPixels");
+		gl.GenBuffers     = (GenBuffersProc)rlGetProcAddress("glGenBuffers");
+		gl.DeleteBuffers  = (DeleteBuffersProc)rlGetProcAddress("glDeleteBuffers");
+		gl.BindBuffer     = (BindBufferProc)rlGetProcAddress("glBindBuffer");
+		gl.BufferData     = (BufferDataProc)rlGetProcAddress("glBufferData");
+		gl.MapBufferRange = (MapBufferRangeProc)rlGetProcAddress("glMapBufferRange");
+		gl.UnmapBuffer    = (UnmapBufferProc)rlGetProcAddress("glUnmapBuffer");
+		gl.FenceSync      = (FenceSyncProc)rlGetProcAddress("glFenceSync");
+		gl.ClientWaitSync = (ClientWaitSyncProc)rlGetProcAddress("glClientWaitSync");
+		gl.DeleteSync     = (DeleteSyncProc)rlGetProcAddress("glDeleteSync");
+		gl.GetIntegerv    = (GetIntegervProc)rlGetProcAddress("glGetIntegerv");
+
+		// core in GL 3.3, ES only has them behind EXT_disjoint_timer_query
+		if (rlGetVersion() == RL_OPENGL_33 || rlGetVersion() == RL_OPENGL_43) {
+			gl.GenQueries          = (GenQueriesProc)rlGetProcAddress("glGenQueries");
+			gl.DeleteQueries       = (DeleteQueriesProc)rlGetProcAddress("glDeleteQueries");
+			gl.QueryCounter        = (QueryCounterProc)rlGetProcAddress("glQueryCounter");
+			gl.GetQueryObjectiv    = (GetQueryObjectivProc)rlGetProcAddress("glGetQueryObjectiv");
+			gl.GetQueryObjectui64v = (GetQueryObjectui64vProc)rlGetProcAddress("glGetQueryObjectui64v");
+		}
+
+		gl.hasPbo = gl.ReadPixels && gl.GenBuffers && gl.DeleteBuffers && gl.BindBuffer &&
+			gl.BufferData && gl.MapBufferRange && gl.UnmapBuffer &&
+			gl.FenceSync && gl.ClientWaitSync && gl.DeleteSync;
+		gl.hasTimer = gl.GenQueries && gl.DeleteQueries && gl.QueryCounter &&
+			gl.GetQueryObjectiv && gl.GetQueryObjectui64v;
+	}
+
+	void ReadSync(const RenderTexture2D& target, int x, int y, int w, int h, unsigned char* out) {
+		if (gl.ReadPixels) {
+			rlEnableFramebuffer(target.id);
+			gl.ReadPixels(x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, out);
+			rlDisableFramebuffer();
+			return;
+		}
+
+		// no direct readback at all, pull the whole texture and crop it
+		Image img = LoadImageFromTexture(target.texture);
+		const unsigned char* src = (const unsigned char*)img.data;
+		for (int row = 0; row < h; ++row) {
+			const unsigned char* line = src + ((size_t)(y + row) * img.width + x) * 4;
+			std::copy(line, line + (size_t)w * 4, out + (size_t)row * w * 4);
+		}
+		UnloadImage(img);
+	}
+}
+
+Readback::Readback(const RenderTexture2D& target)
+	: Readback(target, 0, 0, target.texture.width, target.texture.height)
+{
+}
+
+Readback::Readback(const RenderTexture2D& target, int x, int y, int w, int h)
+	: width(w), height(h), pending(true)
+{
+	ProfileScope profile(PROFILE_TRANSFERS);
+	LoadProcs();
+	rlDrawRenderBatchActive();
+
+	if (!gl.hasPbo) {
+		data.resize((size_t)w * h * 4);
+		ReadSync(target, x, y, w, h, data.data());
+		return;
+	}
+
+	gl.GenBuffers(1, &pbo);
+	gl.BindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+	gl.BufferData(GL_PIXEL_PACK_BUFFER, (ptrdiff_t)w * h * 4, nullptr, GL_STREAM_READ);
+
+	rlEnableFramebuffer(target.id);
+	gl.ReadPixels(x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	rlDisableFramebuffer();
+
+	gl.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	fence = gl.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+Readback::~Readback() {
+	release();
+}
+
+Readback::Readback(Readback&& other) noexcept
+	: pbo(other.pbo), fence(other.fence), width(other.width), height(other.height),
+	  pending(other.pending), data(std::move(other.data))
+{
+	other.pbo = 0;
+	other.fence = nullptr;
+	other.pending = false;
+}
+
+Readback& Readback::operator=(Readback&& other) noexcept {
+	if (this != &other) {
+		release();
+		pbo = other.pbo;
+		fence = other.fence;
+		width = other.width;
+		height = other.height;
+		pending = other.pending;
+		data = std::move(other.data);
+		other.pbo = 0;
+		other.fence = nullptr;
+		other.pending = false;
+	}
+	return *this;
+}
+
+void Readback::release() {
+	if (fence)
+		gl.DeleteSync(fence);
+	if (pbo)
+		gl.DeleteBuffers(1, &pbo);
+	fence = nullptr;
+	pbo = 0;
+	pending = false;
+	data.clear();
+}
+
+bool Readback::Valid() const {
+	return pending;
+}
+
+bool Readback::Ready() {
+	if (!pending)
+		return false;
+	if (!fence)
+		return true;
+
+	unsigned int status = gl.ClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED || status == GL_WAIT_FAILED;
+}
+
+bool Readback::Resolve(unsigned char* out) {
+	if (!pending)
+		return false;
+
+	ProfileScope profile(PROFILE_TRANSFERS);
+	size_t size = (size_t)width * height * 4;
+	if (!pbo) {
+		memcpy(out, data.data(), size);
+		release();
+		return true;
+	}
+
+	for (;;) {
+		unsigned int status = gl.ClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+		if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED || status == GL_WAIT_FAILED)
+			break;
+	}
+
+	gl.BindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+	const void* mapped = gl.MapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (ptrdiff_t)size, GL_MAP_READ_BIT);
+	bool ok = mapped != nullptr;
+	if (ok) {
+		memcpy(out, mapped, size);
+		gl.UnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	gl.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	release();
+	return ok;
+}
+
+Image Readback::ResolveImage() {
+	Image img = {};
+	if (!pending)
+		return img;
+
+	img.data = MemAlloc((unsigned int)((size_t)width * height * 4));
+	img.width = width;
+	img.height = height;
+	img.mipmaps = 1;
+	img.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+
+	if (!Resolve((unsigned char*)img.data)) {
+		MemFree(img.data);
+		img = {};
+	}
+	return img;
+}
+
+int Readback::Width() const {
+	return width;
+}
+
+int Readback::Height() const {
+	return height;
+}
+
+void WriteTextureRegion(const RenderTexture2D& target, int x, int y, int w, int h, const unsigned char* pixels) {
+	ProfileScope profile(PROFILE_TRANSFERS);
+	rlDrawRenderBatchActive();
+	UpdateTextureRec(target.texture, Rectangle{ (float)x, (float)y, (float)w, (float)h }, pixels);
+}
+
+void BlitTextureRegion(const RenderTexture2D& src, int sx, int sy, const RenderTexture2D& dst, int dx, int dy, int w, int h) {
+	ProfileScope profile(PROFILE_TRANSFERS);
+	rlDrawRenderBatchActive();
+	rlBindFramebuffer(RL_READ_FRAMEBUFFER, src.id);
+	rlBindFramebuffer(RL_DRAW_FRAMEBUFFER, dst.id);
+	// despite the parameter names this forwards straight to glBlitFramebuffer,
+	// which wants corner coordinates rather than sizes
+	rlBlitFramebuffer(sx, sy, sx + w, sy + h, dx, dy, dx + w, dy + h, GL_COLOR_BUFFER_BIT);
+	rlDisableFramebuffer();
+}
+
+int MaxTextureUnits() {
+	LoadProcs();
+	int units = 0;
+	if (gl.GetIntegerv)
+		gl.GetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &units);
+	return units;
+}
+
+bool GpuTimestampsSupported() {
+	LoadProcs();
+	return gl.hasTimer;
+}
+
+unsigned int GpuTimestamp() {
+	LoadProcs();
+	if (!gl.hasTimer)
+		return 0;
+
+	// what's batched so far has to be submitted before the stamp, or it'd
+	// be counted to whatever flushes it
+	rlDrawRenderBatchActive();
+
+	unsigned int query = 0;
+	if (!freeQueries.empty()) {
+		query = freeQueries.back();
+		freeQueries.pop_back();
+	} else {
+		gl.GenQueries(1, &query);
+	}
+	gl.QueryCounter(query, GL_TIMESTAMP);
+	return query;
+}
+
+bool ReadGpuTimestamp(unsigned int query, uint64_t* ns) {
+	if (!query || !gl.hasTimer)
+		return false;
+	int available = 0;
+	gl.GetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return false;
+	gl.GetQueryObjectui64v(query, GL_QUERY_RESULT, ns);
+	return true;
+}
+
+void ReleaseGpuTimestamp(unsigned int query) {
+	if (query && gl.hasTimer)
+		freeQueries.push_back(query);
+}
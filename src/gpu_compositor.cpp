@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <string>
+
+#include "gpu.h"
+#include "gpu_compositor.h"
+#include "rlgl.h"
+
+namespace {
+
+// Same equations as blend_row_scalar() in compositor.cpp, in floats. d is
+// what's below, everything stays in registers until the last layer.
+const char* BLEND_FUNCTION = R"(
+vec4 blend(vec4 d, vec4 s, float opacity, int mode) {
+	float sa = s.a * opacity;
+	vec4 S = vec4(s.rgb, sa);
+	vec4 r;
+	if (mode == MODE_ADDITIVE) {
+		r = S * sa + d;
+	} else if (mode == MODE_MULTIPLIED) {
+		r = S * d + d * (1.0 - sa);
+	} else if (mode == MODE_PREMULTIPLIED) {
+		r = s + d * (1.0 - s.a);
+	} else {
+		vec3 b = s.rgb;
+		if (mode == MODE_SCREEN)
+			b = s.rgb + d.rgb - s.rgb * d.rgb;
+		else if (mode == MODE_OVERLAY)
+			b = mix(2.0 * s.rgb * d.rgb, 1.0 - 2.0 * (1.0 - s.rgb) * (1.0 - d.rgb), step(0.5, d.rgb));
+		else if (mode == MODE_DARKEN)
+			b = min(s.rgb, d.rgb);
+		r = vec4(b, sa) * sa + d * (1.0 - sa);
+	}
+	return clamp(r, 0.0, 1.0);
+}
+)";
+
+// Samplers can't be picked by a loop index in every GLSL version this may
+// run on, so the layers get one each and the loop is written out.
+std::string fragment_source(size_t units) {
+	int version = rlGetVersion();
+	bool modern = version == RL_OPENGL_33 || version == RL_OPENGL_43 || version == RL_OPENGL_ES_30;
+
+	std::string src;
+	if (version == RL_OPENGL_ES_30)
+		src += "#version 300 es\nprecision highp float;\n";
+	else if (version == RL_OPENGL_ES_20)
+		src += "#version 100\nprecision mediump float;\n";
+	else if (modern)
+		src += "#version 330\n";
+	else
+		src += "#version 120\n";
+
+	if (modern)
+		src += "in vec2 fragTexCoord;\nout vec4 finalColor;\n#define TEXTURE texture\n";
+	else
+		src += "varying vec2 fragTexCoord;\n#define finalColor gl_FragColor\n#define TEXTURE texture2D\n";
+
+	src += "#define MODE_ADDITIVE " + std::to_string(LAYER_BLEND_ADDITIVE) + "\n";
+	src += "#define MODE_MULTIPLIED " + std::to_string(LAYER_BLEND_MULTIPLIED) + "\n";
+	src += "#define MODE_SCREEN " + std::to_string(LAYER_BLEND_SCREEN) + "\n";
+	src += "#define MODE_OVERLAY " + std::to_string(LAYER_BLEND_OVERLAY) + "\n";
+	src += "#define MODE_DARKEN " + std::to_string(LAYER_BLEND_DARKEN) + "\n";
+	src += "#define MODE_PREMULTIPLIED " + std::to_string(GPU_BLEND_PREMULTIPLIED) + "\n";
+
+	std::string n = std::to_string(units);
+	src += "uniform sampler2D texture0;\n";
+	for (size_t i = 0; i < units; ++i)
+		src += "uniform sampler2D layer" + std::to_string(i) + ";\n";
+	src += "uniform int hasBase;\n";
+	src += "uniform vec4 background;\n";
+	src += "uniform int count;\n";
+	src += "uniform float opacity[" + n + "];\n";
+	src += "uniform int mode[" + n + "];\n";
+	src += BLEND_FUNCTION;
+
+	src += "void main() {\n";
+	src += "\tvec4 d = hasBase != 0 ? TEXTURE(texture0, fragTexCoord) : background;\n";
+	for (size_t i = 0; i < units; ++i) {
+		std::string k = std::to_string(i);
+		src += "\tif (count > " + k + ") d = blend(d, TEXTURE(layer" + k + ", fragTexCoord), opacity[" + k + "], mode[" + k + "]);\n";
+	}
+	src += "\tfinalColor = d;\n}\n";
+	return src;
+}
+
+BlendMode fixed_blend(int mode) {
+	switch (mode) {
+	case LAYER_BLEND_ADDITIVE: return BLEND_ADDITIVE;
+	case LAYER_BLEND_MULTIPLIED: return BLEND_MULTIPLIED;
+	case GPU_BLEND_PREMULTIPLIED: return BLEND_ALPHA_PREMULTIPLY;
+	default: return BLEND_ALPHA;
+	}
+}
+
+}
+
+GpuCompositor::~GpuCompositor() {
+	if (shader.id != 0)
+		UnloadShader(shader);
+	for (RenderTexture2D& target : scratch)
+		if (target.id != 0)
+			UnloadRenderTexture(target);
+}
+
+void GpuCompositor::load() {
+	tried = true;
+	if (rlGetVersion() == RL_OPENGL_11 || rlGetVersion() == RL_OPENGL_SOFTWARE)
+		return;
+
+	// unit 0 is the base, the batch binds it. raylib only rebinds units
+	// 1..RL_DEFAULT_BATCH_MAX_TEXTURE_UNITS for SetShaderValueTexture(),
+	// which nothing here uses, so the layers take them from 1 up.
+	int available = MaxTextureUnits() - 1;
+	if (available < 1)
+		return;
+	size_t count = std::min((size_t)available, (size_t)GPU_COMPOSITE_MAX_UNITS);
+
+	std::string fs = fragment_source(count);
+	Shader loaded = LoadShaderFromMemory(nullptr, fs.c_str());
+	// a shader that doesn't build comes back as raylib's default one
+	if (!IsShaderValid(loaded) || loaded.id == rlGetShaderIdDefault())
+		return;
+
+	shader = loaded;
+	units = count;
+	hasBaseLoc = GetShaderLocation(shader, "hasBase");
+	backgroundLoc = GetShaderLocation(shader, "background");
+	countLoc = GetShaderLocation(shader, "count");
+	opacityLoc = GetShaderLocation(shader, "opacity");
+	modeLoc = GetShaderLocation(shader, "mode");
+	for (size_t i = 0; i < units; ++i) {
+		int unit = (int)i + 1;
+		SetShaderValue(shader, GetShaderLocation(shader, TextFormat("layer%d", (int)i)), &unit, SHADER_UNIFORM_INT);
+	}
+}
+
+size_t GpuCompositor::Units() {
+	if (!tried)
+		load();
+	return units;
+}
+
+RenderTexture2D& GpuCompositor::scratch_target(int i, int width, int height) {
+	RenderTexture2D& target = scratch[i];
+	if (target.id != 0 && (target.texture.width != width || target.texture.height != height)) {
+		UnloadRenderTexture(target);
+		target = {};
+	}
+	if (target.id == 0)
+		target = LoadRenderTexture(width, height);
+	return target;
+}
+
+void GpuCompositor::fixed_function(const Texture2D* base, Color background, const GpuLayer* layers, size_t count,
+		Rectangle source, Rectangle dest, Vector2 origin, float rotation)
+{
+	rlSetBlendFactors(RL_ONE, RL_ZERO, RL_FUNC_ADD);
+	BeginBlendMode(BLEND_CUSTOM);
+	if (base)
+		DrawTexturePro(*base, source, dest, origin, rotation, WHITE);
+	else
+		DrawRectanglePro(dest, origin, rotation, background);
+	EndBlendMode();
+
+	for (size_t i = 0; i < count; ++i) {
+		const GpuLayer& l = layers[i];
+		unsigned char opacity = l.blendMode == GPU_BLEND_PREMULTIPLIED ? 255 : l.opacity;
+		BeginBlendMode(fixed_blend(l.blendMode));
+		DrawTexturePro(l.texture, source, dest, origin, rotation, Color{255, 255, 255, opacity});
+		EndBlendMode();
+	}
+}
+
+void GpuCompositor::pass(const Texture2D* base, Color background, const GpuLayer* layers, size_t count,
+		Rectangle source, Rectangle dest, Vector2 origin, float rotation)
+{
+	if (count == 0 || count > Units()) {
+		fixed_function(base, background, layers, count, source, dest, origin, rotation);
+		return;
+	}
+
+	// whatever's queued goes out with the bindings it was made with
+	rlDrawRenderBatchActive();
+
+	float opacity[GPU_COMPOSITE_MAX_UNITS];
+	int mode[GPU_COMPOSITE_MAX_UNITS];
+	for (size_t i = 0; i < count; ++i) {
+		rlActiveTextureSlot((int)i + 1);
+		rlEnableTexture(layers[i].texture.id);
+		opacity[i] = layers[i].opacity / 255.0f;
+		mode[i] = layers[i].blendMode;
+	}
+	rlActiveTextureSlot(0);
+
+	int hasBase = base != nullptr;
+	int layerCount = (int)count;
+	Vector4 color = ColorNormalize(background);
+	SetShaderValue(shader, hasBaseLoc, &hasBase, SHADER_UNIFORM_INT);
+	SetShaderValue(shader, backgroundLoc, &color, SHADER_UNIFORM_VEC4);
+	SetShaderValue(shader, countLoc, &layerCount, SHADER_UNIFORM_INT);
+	SetShaderValueV(shader, opacityLoc, opacity, SHADER_UNIFORM_FLOAT, layerCount);
+	SetShaderValueV(shader, modeLoc, mode, SHADER_UNIFORM_INT, layerCount);
+
+	// the shader did the blending, what it writes replaces what's there
+	rlSetBlendFactors(RL_ONE, RL_ZERO, RL_FUNC_ADD);
+	BeginBlendMode(BLEND_CUSTOM);
+	BeginShaderMode(shader);
+	DrawTexturePro(base ? *base : layers[0].texture, source, dest, origin, rotation, WHITE);
+	EndShaderMode();
+	EndBlendMode();
+
+	for (size_t i = 0; i < count; ++i) {
+		rlActiveTextureSlot((int)i + 1);
+		rlDisableTexture();
+	}
+	rlActiveTextureSlot(0);
+}
+
+void GpuCompositor::Draw(const Texture2D* base, Color background, const GpuLayer* layers, size_t count,
+		Rectangle source, Rectangle dest, Vector2 origin, float rotation)
+{
+	size_t per = Units();
+	if (per && count > per) {
+		int width = layers[0].texture.width;
+		int height = layers[0].texture.height;
+		size_t split = count - per;
+		const Texture2D& below = Flatten(base, background, layers, split, width, height, DirtyRect{ 0, 0, width, height });
+		pass(&below, background, layers + split, per, source, dest, origin, rotation);
+		return;
+	}
+	pass(base, background, layers, count, source, dest, origin, rotation);
+}
+
+void GpuCompositor::Flatten(const Texture2D* base, Color background, const GpuLayer* layers, size_t count,
+		RenderTexture2D& target, DirtyRect region)
+{
+	if (region.Empty())
+		return;
+
+	int width = target.texture.width;
+	int height = target.texture.height;
+	size_t per = Units() ? Units() : std::max(count, (size_t)1);
+	size_t passes = std::max((size_t)1, (count + per - 1) / per);
+	Rectangle source = { 0, 0, (float)width, -(float)height };
+	Rectangle dest = { 0, 0, (float)width, (float)height };
+
+	// every pass reads the one before, alternating so the last lands in target
+	const Texture2D* below = base;
+	for (size_t p = 0; p < passes; ++p) {
+		RenderTexture2D& out = (passes - 1 - p) % 2 == 0 ? target : scratch_target(1, width, height);
+		size_t first = p * per;
+		size_t n = std::min(per, count - first);
+
+		// texture rows run bottom up like the framebuffer's, so the region
+		// goes to the scissor as it is
+		BeginTextureMode(out);
+		rlEnableScissorTest();
+		rlScissor(region.x, region.y, region.w, region.h);
+		pass(below, background, layers + first, n, source, dest, { 0, 0 }, 0.0f);
+		rlDrawRenderBatchActive();
+		rlDisableScissorTest();
+		EndTextureMode();
+		below = &out.texture;
+	}
+}
+
+const Texture2D& GpuCompositor::Flatten(const Texture2D* base, Color background, const GpuLayer* layers, size_t count,
+		int width, int height, DirtyRect region)
+{
+	RenderTexture2D& out = scratch_target(0, width, height);
+	Flatten(base, background, layers, count, out, region);
+	return out.texture;
+}
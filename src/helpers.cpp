@@ -1,4 +1,5 @@
 #include "helpers.h"
+#include "rlgl.h"
 #include <cmath>
 
 // helpers
@@ -29,3 +30,21 @@ float NormalizeAngleDelta(float delta) {
 	while (delta < -PI) delta += 2.0f*PI;
 	return delta;
 }
+
+// one brush/eraser segment, shared by live drawing and stroke replay
+void DrawStrokeSegment(const RenderTexture2D& target, Vector2 from, Vector2 to, float radius, Color color, bool isBrush) {
+	BeginTextureMode(target);
+
+	if (!isBrush) {
+		rlSetBlendFactors(RL_ZERO, RL_ONE_MINUS_SRC_ALPHA, RL_SRC_ALPHA);
+		rlSetBlendMode(BLEND_CUSTOM);
+	}
+
+	DrawCircleV(from, radius, isBrush ? color : WHITE);
+	DrawLineEx(from, to, 2*radius, isBrush ? color : WHITE);
+	DrawCircleV(to, radius, isBrush ? color : WHITE);
+
+	if (!isBrush)
+		rlSetBlendMode(BLEND_ALPHA);
+	EndTextureMode();
+}
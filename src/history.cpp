@@ -0,0 +1,549 @@
+#include <algorithm>
+
+#include "history.h"
+#include "gpu.h"
+#include "rlgl.h"
+#include "tile_codec.h"
+
+#define POOL_SLOTS_PER_ROW  (HISTORY_POOL_PAGE_SIZE / HISTORY_TILE_SIZE)
+#define POOL_SLOTS_PER_PAGE (POOL_SLOTS_PER_ROW * POOL_SLOTS_PER_ROW)
+#define POOL_PAGE_BYTES     ((size_t)HISTORY_POOL_PAGE_SIZE * HISTORY_POOL_PAGE_SIZE * 4)
+
+TilePool::TilePool(size_t budget)
+	: maxPages(budget / POOL_PAGE_BYTES)
+{
+}
+
+TilePool::~TilePool() {
+	for (RenderTexture2D& page : pages)
+		UnloadRenderTexture(page);
+}
+
+bool TilePool::Enabled() const {
+	// rlBlitFramebuffer() compiles to nothing before GL 3.3 / ES 3.0, the
+	// pool would store and restore nothing there
+	int version = rlGetVersion();
+	bool canBlit = version == RL_OPENGL_33 || version == RL_OPENGL_43 || version == RL_OPENGL_ES_30;
+	return maxPages > 0 && canBlit;
+}
+
+bool TilePool::grow() {
+	if (pages.size() >= maxPages)
+		return false;
+
+	RenderTexture2D page = LoadRenderTexture(HISTORY_POOL_PAGE_SIZE, HISTORY_POOL_PAGE_SIZE);
+	if (page.id == 0) {
+		maxPages = pages.size();
+		return false;
+	}
+
+	int first = (int)pages.size() * POOL_SLOTS_PER_PAGE;
+	pages.push_back(page);
+	for (int i = POOL_SLOTS_PER_PAGE - 1; i >= 0; --i)
+		freeSlots.push_back(first + i);
+
+	if (swapSlot < 0) {
+		swapSlot = freeSlots.back();
+		freeSlots.pop_back();
+	}
+	return true;
+}
+
+int TilePool::Allocate() {
+	if (freeSlots.empty() && !grow())
+		return -1;
+
+	int slot = freeSlots.back();
+	freeSlots.pop_back();
+	usedSlots++;
+	return slot;
+}
+
+void TilePool::Free(int slot) {
+	freeSlots.push_back(slot);
+	usedSlots--;
+}
+
+void TilePool::slot_rect(int slot, const RenderTexture2D** page, int* x, int* y) const {
+	int index = slot % POOL_SLOTS_PER_PAGE;
+	*page = &pages[slot / POOL_SLOTS_PER_PAGE];
+	*x = (index % POOL_SLOTS_PER_ROW) * HISTORY_TILE_SIZE;
+	*y = (index / POOL_SLOTS_PER_ROW) * HISTORY_TILE_SIZE;
+}
+
+void TilePool::Store(int slot, const RenderTexture2D& layer, const HistoryTile& tile) {
+	const RenderTexture2D* page;
+	int x, y;
+	slot_rect(slot, &page, &x, &y);
+	BlitTextureRegion(layer, tile.x, tile.y, *page, x, y, tile.w, tile.h);
+}
+
+void TilePool::Swap(int slot, const RenderTexture2D& layer, const HistoryTile& tile) {
+	const RenderTexture2D* page;
+	const RenderTexture2D* swapPage;
+	int x, y, sx, sy;
+	slot_rect(slot, &page, &x, &y);
+	slot_rect(swapSlot, &swapPage, &sx, &sy);
+
+	BlitTextureRegion(layer, tile.x, tile.y, *swapPage, sx, sy, tile.w, tile.h);
+	BlitTextureRegion(*page, x, y, layer, tile.x, tile.y, tile.w, tile.h);
+	BlitTextureRegion(*swapPage, sx, sy, *page, x, y, tile.w, tile.h);
+}
+
+Readback TilePool::Read(int slot, const HistoryTile& tile) const {
+	const RenderTexture2D* page;
+	int x, y;
+	slot_rect(slot, &page, &x, &y);
+	return Readback(*page, x, y, tile.w, tile.h);
+}
+
+size_t TilePool::Capacity() const {
+	return maxPages > 0 ? maxPages * POOL_SLOTS_PER_PAGE - 1 : 0;
+}
+
+size_t TilePool::FreeSlots() const {
+	size_t unallocated = (maxPages - pages.size()) * POOL_SLOTS_PER_PAGE;
+	if (pages.empty() && unallocated > 0)
+		unallocated--;
+	return freeSlots.size() + unallocated;
+}
+
+size_t TilePool::UsedBytes() const {
+	return pages.size() * POOL_PAGE_BYTES;
+}
+
+History::History(size_t budget, size_t spillBudget, size_t vramBudget)
+	: budget(budget), spillBudget(spillBudget), pool(vramBudget)
+{
+}
+
+History::~History() {
+	Clear();
+	compressor.Wait();
+}
+
+void History::BeginStroke(const Layer& layer, size_t layerIndex) {
+	EndStroke();
+
+	tilesX = (layer.width  + HISTORY_TILE_SIZE - 1) / HISTORY_TILE_SIZE;
+	tilesY = (layer.height + HISTORY_TILE_SIZE - 1) / HISTORY_TILE_SIZE;
+	captured.assign((size_t)tilesX * tilesY, false);
+
+	pending = std::make_shared<HistoryEntry>();
+	pending->layer = layerIndex;
+	pending->onGpu = pool.Enabled();
+}
+
+void History::CaptureRegion(const Layer& layer, int x, int y, int w, int h) {
+	if (!pending)
+		return;
+
+	int x0 = std::max(x, 0);
+	int y0 = std::max(y, 0);
+	int x1 = std::min(x + w, layer.width);
+	int y1 = std::min(y + h, layer.height);
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	for (int ty = y0 / HISTORY_TILE_SIZE; ty <= (y1 - 1) / HISTORY_TILE_SIZE; ++ty) {
+		for (int tx = x0 / HISTORY_TILE_SIZE; tx <= (x1 - 1) / HISTORY_TILE_SIZE; ++tx) {
+			size_t idx = (size_t)ty * tilesX + tx;
+			if (captured[idx])
+				continue;
+			captured[idx] = true;
+
+			HistoryTile tile;
+			tile.x = tx * HISTORY_TILE_SIZE;
+			tile.y = ty * HISTORY_TILE_SIZE;
+			tile.w = std::min(HISTORY_TILE_SIZE, layer.width  - tile.x);
+			tile.h = std::min(HISTORY_TILE_SIZE, layer.height - tile.y);
+
+			if (pending->onGpu) {
+				int slot = pool.Allocate();
+				if (slot >= 0) {
+					pool.Store(slot, layer.tex, tile);
+					pending->slots.push_back(slot);
+					pending->tiles.push_back(tile);
+					continue;
+				}
+				// pool is full, the rest of this stroke goes through the CPU
+				demote(*pending);
+			}
+
+			size_t offset = pending->pixels.size();
+			pending->pixels.resize(offset + (size_t)tile.w * tile.h * 4);
+			pending->reads.push_back(PendingRead{ offset, Readback(layer.tex, tile.x, tile.y, tile.w, tile.h) });
+			pending->tiles.push_back(tile);
+		}
+	}
+}
+
+void History::EndStroke() {
+	if (!pending)
+		return;
+
+	EntryPtr entry = std::move(pending);
+	pending = nullptr;
+	captured.clear();
+
+	if (entry->tiles.empty())
+		return;
+
+	ClearRedo();
+	undo.push_front(entry);
+
+	if (!entry->onGpu) {
+		entry->rawBytes = entry->pixels.size();
+		entry->heldBytes = entry->pixels.size();
+		rawBytes += entry->rawBytes;
+		heldBytes += entry->heldBytes;
+		settling.push_back(entry);
+	}
+	trim();
+}
+
+void History::Update() {
+	for (size_t i = 0; i < settling.size();) {
+		EntryPtr entry = settling[i];
+		bool ready = true;
+		{
+			std::lock_guard<std::mutex> guard(entry->lock);
+			if (!entry->dropped) {
+				for (PendingRead& pr : entry->reads)
+					ready = ready && pr.read.Ready();
+				if (ready)
+					settle(*entry);
+			}
+		}
+
+		if (!ready) {
+			++i;
+			continue;
+		}
+		settling.erase(settling.begin() + i);
+		if (!entry->dropped)
+			compress(entry);
+	}
+}
+
+bool History::Settling() const {
+	return !settling.empty();
+}
+
+bool History::restore(std::deque<EntryPtr>& from, std::deque<EntryPtr>& to, std::deque<Layer>& layers) {
+	EndStroke();
+	if (from.empty())
+		return false;
+
+	EntryPtr entry = from.front();
+	from.pop_front();
+
+	if (entry->layer >= layers.size()) {
+		drop(entry);
+		return false;
+	}
+
+	if (entry->onGpu) {
+		const Layer& layer = layers[entry->layer];
+		for (size_t i = 0; i < entry->tiles.size(); ++i) {
+			const HistoryTile& tile = entry->tiles[i];
+			pool.Swap(entry->slots[i], layer.tex, tile);
+			if (onRestore)
+				onRestore(entry->layer, tile.x, tile.y, tile.w, tile.h);
+		}
+
+		to.push_front(entry);
+		trim();
+		return true;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(entry->lock);
+		entry->spillQueued = false;
+
+		settle(*entry);
+		if (!unpack(*entry)) {
+			release(*entry);
+			return false;
+		}
+
+		// swap each stored tile with what is on the layer right now, so the
+		// same entry can walk back the other way. The reads are queued ahead
+		// of the uploads, so they still see the old contents.
+		const Layer& layer = layers[entry->layer];
+		std::vector<unsigned char> stored;
+		stored.swap(entry->pixels);
+		entry->pixels.resize(stored.size());
+
+		size_t offset = 0;
+		for (const HistoryTile& tile : entry->tiles) {
+			entry->reads.push_back(PendingRead{ offset, Readback(layer.tex, tile.x, tile.y, tile.w, tile.h) });
+			WriteTextureRegion(layer.tex, tile.x, tile.y, tile.w, tile.h, stored.data() + offset);
+			offset += (size_t)tile.w * tile.h * 4;
+			if (onRestore)
+				onRestore(entry->layer, tile.x, tile.y, tile.w, tile.h);
+		}
+
+		std::vector<unsigned char>().swap(entry->packed);
+		heldBytes -= entry->heldBytes;
+		entry->heldBytes = entry->pixels.size();
+		heldBytes += entry->heldBytes;
+	}
+
+	to.push_front(entry);
+	settling.push_back(entry);
+	trim();
+	return true;
+}
+
+// pack/unpack/settle/release expect entry.lock to be held
+bool History::pack(HistoryEntry& entry) {
+	if (!entry.packed.empty())
+		return true;
+	if (entry.pixels.empty() || !entry.reads.empty())
+		return false;
+
+	int size = 0;
+	unsigned char* data = CompressData(entry.pixels.data(), (int)entry.pixels.size(), &size);
+	if (!data)
+		return false;
+
+	entry.packed.assign(data, data + size);
+	MemFree(data);
+	std::vector<unsigned char>().swap(entry.pixels);
+
+	heldBytes -= entry.heldBytes;
+	entry.heldBytes = entry.packed.size();
+	heldBytes += entry.heldBytes;
+	return true;
+}
+
+bool History::unpack(HistoryEntry& entry) {
+	if (entry.spilled) {
+		entry.packed.resize(entry.spillSize);
+		bool ok = scratch.Read(entry.spillOffset, entry.packed.data(), entry.spillSize);
+
+		scratch.Free(entry.spillOffset, entry.spillSize);
+		spilledBytes -= entry.spillSize;
+		entry.spilled = false;
+		entry.heldBytes = entry.packed.size();
+		heldBytes += entry.heldBytes;
+		if (!ok)
+			return false;
+	}
+
+	if (!entry.pixels.empty())
+		return true;
+
+	entry.pixels.resize(entry.rawBytes);
+	if (!InflateExact(entry.packed.data(), entry.packed.size(), entry.pixels.data(), entry.pixels.size())) {
+		std::vector<unsigned char>().swap(entry.pixels);
+		return false;
+	}
+	return true;
+}
+
+void History::demote(HistoryEntry& entry) {
+	if (!entry.onGpu)
+		return;
+
+	size_t total = 0;
+	for (const HistoryTile& tile : entry.tiles)
+		total += (size_t)tile.w * tile.h * 4;
+
+	// slots can go back to the pool right away, anything that reuses them
+	// is queued behind these reads
+	entry.pixels.resize(total);
+	size_t offset = 0;
+	for (size_t i = 0; i < entry.tiles.size(); ++i) {
+		const HistoryTile& tile = entry.tiles[i];
+		entry.reads.push_back(PendingRead{ offset, pool.Read(entry.slots[i], tile) });
+		pool.Free(entry.slots[i]);
+		offset += (size_t)tile.w * tile.h * 4;
+	}
+	entry.slots.clear();
+	entry.onGpu = false;
+}
+
+void History::settle(HistoryEntry& entry) {
+	for (PendingRead& pr : entry.reads)
+		pr.read.Resolve(entry.pixels.data() + pr.offset);
+	entry.reads.clear();
+}
+
+void History::release(HistoryEntry& entry) {
+	if (entry.dropped)
+		return;
+	entry.dropped = true;
+	for (int slot : entry.slots)
+		pool.Free(slot);
+	entry.slots.clear();
+	entry.reads.clear();
+	heldBytes -= entry.heldBytes;
+	rawBytes -= entry.rawBytes;
+	if (entry.spilled) {
+		scratch.Free(entry.spillOffset, entry.spillSize);
+		spilledBytes -= entry.spillSize;
+		entry.spilled = false;
+	}
+	std::vector<unsigned char>().swap(entry.pixels);
+	std::vector<unsigned char>().swap(entry.packed);
+}
+
+void History::compress(const EntryPtr& entry) {
+	compressor.Submit([this, entry] {
+		std::lock_guard<std::mutex> guard(entry->lock);
+		if (!entry->dropped && !entry->spilled)
+			pack(*entry);
+	});
+}
+
+void History::spill(const EntryPtr& entry) {
+	compressor.Submit([this, entry] {
+		std::lock_guard<std::mutex> guard(entry->lock);
+		if (entry->dropped || entry->spilled || !entry->spillQueued)
+			return;
+		if (!pack(*entry)) {
+			// still settling, let a later trim pick it up again
+			entry->spillQueued = false;
+			return;
+		}
+
+		uint64_t offset = 0;
+		if (!scratch.Write(entry->packed.data(), entry->packed.size(), &offset)) {
+			// the scratch file is unusable now, trim() drops by the RAM budget
+			entry->spillQueued = false;
+			return;
+		}
+
+		entry->spilled = true;
+		entry->spillOffset = offset;
+		entry->spillSize = entry->packed.size();
+		spilledBytes += entry->spillSize;
+
+		std::vector<unsigned char>().swap(entry->packed);
+		heldBytes -= entry->heldBytes;
+		entry->heldBytes = 0;
+	});
+}
+
+void History::drop(const EntryPtr& entry) {
+	std::lock_guard<std::mutex> guard(entry->lock);
+	release(*entry);
+}
+
+bool History::Undo(std::deque<Layer>& layers) {
+	return restore(undo, redo, layers);
+}
+
+bool History::Redo(std::deque<Layer>& layers) {
+	return restore(redo, undo, layers);
+}
+
+void History::SwapLayers(size_t a, size_t b) {
+	auto remap = [a, b](HistoryEntry& entry) {
+		if (entry.layer == a)
+			entry.layer = b;
+		else if (entry.layer == b)
+			entry.layer = a;
+	};
+	for (EntryPtr& entry : undo)
+		remap(*entry);
+	for (EntryPtr& entry : redo)
+		remap(*entry);
+	if (pending)
+		remap(*pending);
+}
+
+void History::ClearRedo() {
+	for (EntryPtr& entry : redo)
+		drop(entry);
+	redo.clear();
+}
+
+void History::Clear() {
+	// a stroke still going holds pool slots too
+	if (pending)
+		drop(pending);
+	pending = nullptr;
+	settling.clear();
+	captured.clear();
+	for (EntryPtr& entry : undo)
+		drop(entry);
+	undo.clear();
+	ClearRedo();
+}
+
+
+void History::trim() {
+	// Keep a quarter of the GPU pool free by moving the oldest GPU strokes
+	// to the CPU side here, at pen-up, rather than mid-stroke.
+	if (pool.Enabled()) {
+		size_t reserve = pool.Capacity() / 4;
+		for (size_t i = undo.size(); i-- > 1 && pool.FreeSlots() < reserve;) {
+			HistoryEntry& entry = *undo[i];
+			if (!entry.onGpu)
+				continue;
+
+			std::lock_guard<std::mutex> guard(entry.lock);
+			demote(entry);
+			entry.rawBytes = entry.pixels.size();
+			entry.heldBytes = entry.pixels.size();
+			rawBytes += entry.rawBytes;
+			heldBytes += entry.heldBytes;
+			settling.push_back(undo[i]);
+		}
+	}
+
+	// Past the RAM budget the oldest strokes go to the scratch file; the
+	// newest one stays in memory since it is the next thing undone.
+	// projected is what stays in RAM once the queued spills have landed.
+	bool canSpill = spillBudget > 0 && scratch.Usable();
+	size_t projected = heldBytes;
+	if (canSpill) {
+		for (size_t i = undo.size(); i-- > 1;) {
+			HistoryEntry& entry = *undo[i];
+			if (entry.onGpu)
+				continue;
+
+			std::lock_guard<std::mutex> guard(entry.lock);
+			if (entry.spilled)
+				continue;
+			if (!entry.spillQueued) {
+				if (projected <= budget)
+					continue;
+				entry.spillQueued = true;
+				spill(undo[i]);
+			}
+			projected -= std::min(projected, entry.heldBytes);
+		}
+	}
+
+	// The newest stroke always stays undoable, even if it alone is over
+	// budget. Whatever spilling can't take off the RAM budget is dropped.
+	while (undo.size() > 1) {
+		bool over = canSpill ? spilledBytes > spillBudget || projected > budget : heldBytes > budget;
+		if (!over)
+			break;
+		{
+			HistoryEntry& entry = *undo.back();
+			std::lock_guard<std::mutex> guard(entry.lock);
+			if (!entry.spillQueued && !entry.spilled)
+				projected -= std::min(projected, entry.heldBytes);
+		}
+		drop(undo.back());
+		undo.pop_back();
+	}
+}
+
+size_t History::Depth() const {
+	return undo.size();
+}
+
+size_t History::UsedBytes() const {
+	return heldBytes;
+}
+
+HistoryStats History::Stats() const {
+	return HistoryStats{ undo.size(), redo.size(), heldBytes, rawBytes, spilledBytes, pool.UsedBytes() };
+}
@@ -0,0 +1,401 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "image_export.h"
+#include "raylib.h"
+#include "thread_pool.h"
+
+namespace {
+
+const size_t STRIPE_BYTES = (size_t)2 << 20;
+const int WINDOW_SIZE = 32768;
+const int WINDOW_MASK = WINDOW_SIZE - 1;
+const int HASH_BITS = 15;
+const int MIN_MATCH = 3;
+const int MAX_MATCH = 258;
+const int NICE_MATCH = 128;
+
+const int LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const int LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const int DIST_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const int DIST_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// deflate's fixed codes, bit reversed since the stream is LSB first
+struct FixedCodes {
+	uint16_t lit[288];
+	uint8_t litBits[288];
+	uint8_t dist[30];
+	uint8_t lengthCode[MAX_MATCH + 1];
+	uint8_t distCode[WINDOW_SIZE + 1];
+	uint32_t crc[256];
+
+	static uint32_t reverse(uint32_t code, int bits) {
+		uint32_t out = 0;
+		for (int i = 0; i < bits; ++i, code >>= 1)
+			out = (out << 1) | (code & 1);
+		return out;
+	}
+
+	FixedCodes() {
+		for (int s = 0; s < 288; ++s) {
+			int bits, code;
+			if (s < 144)      { bits = 8; code = 0x30 + s; }
+			else if (s < 256) { bits = 9; code = 0x190 + (s - 144); }
+			else if (s < 280) { bits = 7; code = s - 256; }
+			else              { bits = 8; code = 0xC0 + (s - 280); }
+			lit[s] = (uint16_t)reverse(code, bits);
+			litBits[s] = (uint8_t)bits;
+		}
+		for (int d = 0; d < 30; ++d)
+			dist[d] = (uint8_t)reverse(d, 5);
+		for (int c = 0; c < 29; ++c)
+			for (int l = LENGTH_BASE[c]; l < (c == 28 ? 259 : LENGTH_BASE[c + 1]); ++l)
+				lengthCode[l] = (uint8_t)c;
+		for (int c = 0; c < 30; ++c)
+			for (int d = DIST_BASE[c]; d < (c == 29 ? WINDOW_SIZE + 1 : DIST_BASE[c + 1]); ++d)
+				distCode[d] = (uint8_t)c;
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			crc[i] = c;
+		}
+	}
+};
+
+const FixedCodes& codes() {
+	static const FixedCodes table;
+	return table;
+}
+
+struct BitWriter {
+	std::vector<unsigned char>& out;
+	uint64_t bits = 0;
+	int count = 0;
+
+	BitWriter(std::vector<unsigned char>& out) : out(out) {}
+
+	void put(uint32_t value, int n) {
+		bits |= (uint64_t)value << count;
+		count += n;
+		while (count >= 8) {
+			out.push_back((unsigned char)bits);
+			bits >>= 8;
+			count -= 8;
+		}
+	}
+
+	void align() {
+		if (count > 0)
+			out.push_back((unsigned char)bits);
+		bits = 0;
+		count = 0;
+	}
+};
+
+uint32_t crc32(uint32_t crc, const unsigned char* p, size_t n) {
+	const FixedCodes& t = codes();
+	crc = ~crc;
+	for (size_t i = 0; i < n; ++i)
+		crc = t.crc[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+uint32_t adler32(const unsigned char* p, size_t n) {
+	uint32_t a = 1, b = 0;
+	while (n > 0) {
+		size_t chunk = std::min(n, (size_t)5552);
+		for (size_t i = 0; i < chunk; ++i) {
+			a += p[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+		p += chunk;
+		n -= chunk;
+	}
+	return (b << 16) | a;
+}
+
+// zlib's adler32_combine: the checksum of A followed by B from theirs
+uint32_t adler32_combine(uint32_t a1, uint32_t a2, size_t len2) {
+	const uint64_t BASE = 65521;
+	uint64_t rem = len2 % BASE;
+	uint64_t sum1 = a1 & 0xFFFF;
+	uint64_t sum2 = (rem * sum1) % BASE;
+	sum1 += (a2 & 0xFFFF) + BASE - 1;
+	sum2 += ((a1 >> 16) & 0xFFFF) + ((a2 >> 16) & 0xFFFF) + BASE - rem;
+	sum1 %= BASE;
+	sum2 %= BASE;
+	return (uint32_t)(sum1 | (sum2 << 16));
+}
+
+inline int paeth(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if (pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+// one filtered row, out[0] is the filter type. prev is null on the first row.
+void filter_row(const unsigned char* row, const unsigned char* prev, size_t rowBytes, PNG_LEVEL level, unsigned char* out, std::vector<unsigned char>& scratch) {
+	if (level == PNG_STORED) {
+		out[0] = 0;
+		memcpy(out + 1, row, rowBytes);
+		return;
+	}
+
+	auto apply = [&](int type, unsigned char* dst) {
+		for (size_t i = 0; i < rowBytes; ++i) {
+			int a = i >= 4 ? row[i - 4] : 0;
+			int b = prev ? prev[i] : 0;
+			int c = (prev && i >= 4) ? prev[i - 4] : 0;
+			int pred = 0;
+			switch (type) {
+			case 1: pred = a; break;
+			case 2: pred = b; break;
+			case 3: pred = (a + b) >> 1; break;
+			case 4: pred = paeth(a, b, c); break;
+			}
+			dst[i] = (unsigned char)(row[i] - pred);
+		}
+	};
+
+	if (level == PNG_FAST) {
+		out[0] = 1;
+		apply(1, out + 1);
+		return;
+	}
+
+	// the usual heuristic: smallest sum of the bytes read as signed
+	scratch.resize(rowBytes);
+	uint64_t best = UINT64_MAX;
+	for (int type = 0; type <= 4; ++type) {
+		apply(type, scratch.data());
+		uint64_t cost = 0;
+		for (size_t i = 0; i < rowBytes; ++i)
+			cost += (uint64_t)abs((int)(signed char)scratch[i]);
+		if (cost < best) {
+			best = cost;
+			out[0] = (unsigned char)type;
+			memcpy(out + 1, scratch.data(), rowBytes);
+		}
+	}
+}
+
+void put_stored(BitWriter& bits, const unsigned char* data, size_t size, bool last) {
+	do {
+		size_t block = std::min(size, (size_t)65535);
+		bool final = last && block == size;
+		bits.put(final ? 1 : 0, 3);
+		bits.align();
+		bits.put((uint32_t)block, 16);
+		bits.put((uint32_t)(~block & 0xFFFF), 16);
+		bits.out.insert(bits.out.end(), data, data + block);
+		data += block;
+		size -= block;
+	} while (size > 0);
+}
+
+// Deflates data[start, end) as fixed Huffman blocks, matching back as far
+// as dictStart. Anything but the last stripe ends on an empty stored block
+// so the next one starts on a byte boundary.
+void deflate_stripe(const unsigned char* data, size_t dictStart, size_t start, size_t end, int maxChain, bool last, std::vector<unsigned char>& out) {
+	const FixedCodes& t = codes();
+	BitWriter bits(out);
+	bits.put(last ? 1 : 0, 1);
+	bits.put(1, 2);
+
+	std::vector<int32_t> head((size_t)1 << HASH_BITS, -1);
+	std::vector<int32_t> prev(WINDOW_SIZE, -1);
+	auto hash = [&](size_t p) {
+		uint32_t v = (uint32_t)data[p] | ((uint32_t)data[p + 1] << 8) | ((uint32_t)data[p + 2] << 16);
+		return (v * 2654435761u) >> (32 - HASH_BITS);
+	};
+	auto insert = [&](size_t p) {
+		if (p + MIN_MATCH > end)
+			return;
+		uint32_t h = hash(p);
+		prev[p & WINDOW_MASK] = head[h];
+		head[h] = (int32_t)(p - dictStart);
+	};
+
+	for (size_t p = dictStart; p < start; ++p)
+		insert(p);
+
+	size_t p = start;
+	while (p < end) {
+		int bestLength = 0;
+		size_t bestDist = 0;
+		if (p + MIN_MATCH <= end) {
+			int limit = (int)std::min((size_t)MAX_MATCH, end - p);
+			int32_t candidate = head[hash(p)];
+			for (int chain = maxChain; candidate >= 0 && chain > 0; --chain) {
+				size_t cp = dictStart + candidate;
+				if (p - cp > (size_t)WINDOW_SIZE)
+					break;
+				if (data[cp + bestLength] == data[p + bestLength]) {
+					int length = 0;
+					while (length < limit && data[cp + length] == data[p + length])
+						length++;
+					if (length > bestLength) {
+						bestLength = length;
+						bestDist = p - cp;
+						if (length >= NICE_MATCH || length == limit)
+							break;
+					}
+				}
+				// a newer position took this slot, the chain ends here
+				int32_t next = prev[cp & WINDOW_MASK];
+				if (next >= candidate)
+					break;
+				candidate = next;
+			}
+		}
+
+		if (bestLength >= MIN_MATCH) {
+			int lc = t.lengthCode[bestLength];
+			bits.put(t.lit[257 + lc], t.litBits[257 + lc]);
+			bits.put(bestLength - LENGTH_BASE[lc], LENGTH_EXTRA[lc]);
+			int dc = t.distCode[bestDist];
+			bits.put(t.dist[dc], 5);
+			bits.put((uint32_t)(bestDist - DIST_BASE[dc]), DIST_EXTRA[dc]);
+			for (int i = 0; i < bestLength; ++i)
+				insert(p + i);
+			p += bestLength;
+		} else {
+			bits.put(t.lit[data[p]], t.litBits[data[p]]);
+			insert(p);
+			p++;
+		}
+	}
+	bits.put(t.lit[256], t.litBits[256]);
+
+	if (!last) {
+		bits.put(0, 3);
+		bits.align();
+		bits.put(0x0000, 16);
+		bits.put(0xFFFF, 16);
+	}
+	bits.align();
+}
+
+void put_u32be(std::vector<unsigned char>& out, uint32_t v) {
+	out.push_back((unsigned char)(v >> 24));
+	out.push_back((unsigned char)(v >> 16));
+	out.push_back((unsigned char)(v >> 8));
+	out.push_back((unsigned char)v);
+}
+
+// type and data go in as one buffer since the crc covers both
+void write_chunk(std::ofstream& file, const std::vector<unsigned char>& typeAndData, uint32_t crc) {
+	std::vector<unsigned char> head;
+	put_u32be(head, (uint32_t)(typeAndData.size() - 4));
+	file.write((const char*)head.data(), head.size());
+	file.write((const char*)typeAndData.data(), typeAndData.size());
+	std::vector<unsigned char> tail;
+	put_u32be(tail, crc);
+	file.write((const char*)tail.data(), tail.size());
+}
+
+}
+
+bool WritePng(const std::string& path, const unsigned char* pixels, int width, int height, PNG_LEVEL level) {
+	if (!pixels || width <= 0 || height <= 0)
+		return false;
+
+	size_t rowBytes = (size_t)width * 4;
+	size_t lineBytes = rowBytes + 1;
+	int stripeRows = (int)std::max((size_t)1, STRIPE_BYTES / lineBytes);
+	size_t stripes = (height + stripeRows - 1) / stripeRows;
+	int maxChain = level == PNG_DEFAULT ? 32 : 4;
+
+	// filter everything first, the deflate pass wants to look back into
+	// the stripe before
+	std::vector<unsigned char> filtered(lineBytes * height);
+	SharedPool().ParallelFor(stripes, [&](size_t s) {
+		std::vector<unsigned char> scratch;
+		int y1 = std::min(height, (int)(s + 1) * stripeRows);
+		for (int y = (int)s * stripeRows; y < y1; ++y) {
+			const unsigned char* prev = y > 0 ? pixels + (size_t)(y - 1) * rowBytes : nullptr;
+			filter_row(pixels + (size_t)y * rowBytes, prev, rowBytes, level, filtered.data() + (size_t)y * lineBytes, scratch);
+		}
+	});
+
+	// one IDAT per stripe, the zlib header rides on the first and the
+	// adler32 on the last
+	std::vector<std::vector<unsigned char>> chunks(stripes);
+	std::vector<uint32_t> crcs(stripes);
+	std::vector<uint32_t> adlers(stripes);
+	SharedPool().ParallelFor(stripes, [&](size_t s) {
+		size_t start = s * stripeRows * lineBytes;
+		size_t end = std::min(filtered.size(), start + stripeRows * lineBytes);
+		bool last = s + 1 == stripes;
+
+		std::vector<unsigned char>& out = chunks[s];
+		out.insert(out.end(), { 'I', 'D', 'A', 'T' });
+		if (s == 0) {
+			out.push_back(0x78);
+			out.push_back(0x01);
+		}
+		if (level == PNG_STORED) {
+			BitWriter bits(out);
+			put_stored(bits, filtered.data() + start, end - start, last);
+		} else {
+			size_t dictStart = start > (size_t)WINDOW_SIZE ? start - WINDOW_SIZE : 0;
+			deflate_stripe(filtered.data(), dictStart, start, end, maxChain, last, out);
+		}
+		adlers[s] = adler32(filtered.data() + start, end - start);
+		if (!last)
+			crcs[s] = crc32(0, out.data(), out.size());
+	});
+
+	uint32_t adler = adlers[0];
+	for (size_t s = 1; s < stripes; ++s) {
+		size_t start = s * stripeRows * lineBytes;
+		size_t end = std::min(filtered.size(), start + stripeRows * lineBytes);
+		adler = adler32_combine(adler, adlers[s], end - start);
+	}
+	put_u32be(chunks.back(), adler);
+	crcs.back() = crc32(0, chunks.back().data(), chunks.back().size());
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	file.write((const char*)signature, sizeof(signature));
+
+	std::vector<unsigned char> header = { 'I', 'H', 'D', 'R' };
+	put_u32be(header, (uint32_t)width);
+	put_u32be(header, (uint32_t)height);
+	header.insert(header.end(), { 8, 6, 0, 0, 0 });  // 8-bit RGBA, no interlace
+	write_chunk(file, header, crc32(0, header.data(), header.size()));
+
+	for (size_t s = 0; s < stripes; ++s)
+		write_chunk(file, chunks[s], crcs[s]);
+
+	std::vector<unsigned char> end = { 'I', 'E', 'N', 'D' };
+	write_chunk(file, end, crc32(0, end.data(), end.size()));
+
+	file.close();
+	return !file.fail();
+}
+
+bool ExportPixels(const std::string& path, const unsigned char* pixels, int width, int height, PNG_LEVEL level) {
+	if (IsFileExtension(path.c_str(), ".png"))
+		return WritePng(path, pixels, width, height, level);
+
+	Image img = {};
+	img.data = (void*)pixels;
+	img.width = width;
+	img.height = height;
+	img.mipmaps = 1;
+	img.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+	return ExportImage(img, path.c_str());
+}
@@ -0,0 +1,89 @@
+#include "layer_stream.h"
+
+LayerStream::~LayerStream() {
+	Close();
+}
+
+bool LayerStream::Open(const std::string& path) {
+	Close();
+	if (!file.Open(path))
+		return false;
+
+	if (!ReadCanvasFileIndex(file.Data(), file.Size(), index)) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void LayerStream::Close() {
+	cancelled = true;
+	loader.Wait();
+	cancelled = false;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		ready.clear();
+	}
+	file.Close();
+	index = CanvasFileIndex{};
+}
+
+bool LayerStream::IsOpen() const {
+	return file.IsOpen();
+}
+
+const CanvasFileIndex& LayerStream::Index() const {
+	return index;
+}
+
+bool LayerStream::DecodeLayer(size_t layer, std::vector<unsigned char>& pixels) {
+	return file.IsOpen() && DecodeCanvasLayer(file.Data(), index, layer, pixels);
+}
+
+bool LayerStream::DecodePreview(size_t level, CanvasFilePreview& out) {
+	return file.IsOpen() && DecodeCanvasPreview(file.Data(), index, level, out);
+}
+
+void LayerStream::finish(StreamedItem item) {
+	std::lock_guard<std::mutex> guard(lock);
+	ready.push_back(std::move(item));
+}
+
+void LayerStream::RequestLayer(size_t layer) {
+	loader.Submit([this, layer] {
+		if (cancelled)
+			return;
+		StreamedItem item;
+		item.index = layer;
+		item.width = index.width;
+		item.height = index.height;
+		item.ok = DecodeLayer(layer, item.pixels);
+		finish(std::move(item));
+	});
+}
+
+void LayerStream::RequestPreview(size_t level) {
+	loader.Submit([this, level] {
+		if (cancelled)
+			return;
+		CanvasFilePreview preview;
+		StreamedItem item;
+		item.isPreview = true;
+		item.index = level;
+		item.ok = DecodePreview(level, preview);
+		item.width = preview.width;
+		item.height = preview.height;
+		item.pixels = std::move(preview.pixels);
+		finish(std::move(item));
+	});
+}
+
+bool LayerStream::Poll(StreamedItem& out) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (ready.empty())
+		return false;
+	out = std::move(ready.front());
+	ready.pop_front();
+	return true;
+}
@@ -1,15 +1,21 @@
 #include <raylib.h>
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_hints.h>
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <string>
 
 #include "canvas.h"
 #include "SDLHandler.h"
+#include "profiler.h"
 
 int width = 800;
 int height = 600;
 std::string fileName = "";
+CanvasConfig config;
+// frames a second while nothing changes, 0 = none until something does
+double idleFps = 0.0;
 
 bool handleArgs(int argc, char** argv);
 
@@ -26,22 +32,41 @@ int main(int argc, char** argv){
 	//SetTargetFPS(30);
 
 	HideCursor();
-	Canvas canvas(width, height, 16, fileName);
+	Canvas canvas(width, height, 16, fileName, config);
 	//SetExitKey(KEY_NULL);
 		
 	while(!WindowShouldClose()){
-		PumpSDLTabletInput();
+		SharedProfiler().BeginFrame();
+		{
+			ProfileScope profile(PROFILE_INPUT);
+			PumpSDLTabletInput();
+		}
 		canvas.Update();
 
 		BeginDrawing();
-		ClearBackground(DARKGRAY);
+		ClearBackground(CANVAS_BACKGROUND);
 
 		canvas.Render();
 
 		DrawFPS(20, 20);
+		SharedProfiler().Draw();
 
 		EndDrawing();
+		SharedProfiler().EndFrame();
+
+		// EndDrawing() polled input. With none and nothing on the canvas
+		// moving the next frame would be this one again, so sleep until
+		// input comes, the canvas' next timer or the idle refresh.
+		bool active = ConsumeSDLActivity();
+		double idle = canvas.IdleTimeout();
+		if (idleFps > 0.0)
+			idle = std::min(idle, 1.0 / idleFps);
+		if (!active && idle > 0.0) {
+			WaitForSDLEvent(std::isinf(idle) ? -1.0 : idle);
+			PollInputEvents();
+		}
 	}
+	canvas.FinishSaving();
 	ShutdownSDLTabletInput();
 	CloseWindow();
 	return 0;
@@ -58,11 +83,57 @@ bool handleArgs(int argc, char** argv) {
         } else if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) {
             height = atoi(argv[i + 1]);
             i++;
+        } else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+            config.historyBudget = (size_t)atoi(argv[i + 1]) << 20;
+            i++;
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            config.historySpillBudget = (size_t)atoi(argv[i + 1]) << 20;
+            i++;
+        } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            config.historyVramBudget = (size_t)atoi(argv[i + 1]) << 20;
+            i++;
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            config.historyMode = HISTORY_STROKES;
+            config.strokeKeyframeInterval = (size_t)atoi(argv[i + 1]);
+            i++;
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            config.autosaveInterval = atof(argv[i + 1]);
+            i++;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            config.autosaveBudget = atof(argv[i + 1]) / 1000.0;
+            i++;
+        } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            if (strcmp(argv[i + 1], "fast") == 0)
+                config.exportFormat = EXPORT_PNG_FAST;
+            else if (strcmp(argv[i + 1], "qoi") == 0)
+                config.exportFormat = EXPORT_QOI;
+            else
+                config.exportFormat = EXPORT_PNG;
+            i++;
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            if (!ParseCanvasCodec(argv[i + 1], config.tileCodec))
+                printf("Unknown codec: %s\n", argv[i + 1]);
+            i++;
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            idleFps = atof(argv[i + 1]);
+            i++;
+        } else if (strcmp(argv[i], "-l") == 0) {
+            config.lazyLoad = true;
         } else if (strcmp(argv[i], "--help") == 0) {
             printf("Usage:\n");
             printf("    ./myCanvas\n");
             printf("    ./myCanvas -w <width> -h <height>\n");
             printf("    ./myCanvas -f <fileName>\n");
+            printf("    ./myCanvas -u <undo memory budget in MB>\n");
+            printf("    ./myCanvas -d <undo disk spill budget in MB, 0 = off>\n");
+            printf("    ./myCanvas -g <undo VRAM budget in MB, 0 = off>\n");
+            printf("    ./myCanvas -l (leave hidden layers in the file until they are used)\n");
+            printf("    ./myCanvas -k <strokes per keyframe, switches undo to stroke replay>\n");
+            printf("    ./myCanvas -a <seconds between autosaves, 0 = off>\n");
+            printf("    ./myCanvas -b <autosave time per frame in ms>\n");
+            printf("    ./myCanvas -e <png|fast|qoi> (what Shift+Enter exports, fast is a bigger png)\n");
+            printf("    ./myCanvas -c <runs|runs+deflate|deflate> (how saves pack tiles, fastest to smallest-ish)\n");
+            printf("    ./myCanvas -r <frames per second while idle, 0 = only redraw on changes>\n");
 			return false;
         } else {
             printf("Unknown argument: %s\n", argv[i]);
@@ -0,0 +1,100 @@
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.h"
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+bool MappedFile::Open(const std::string& path) {
+	Close();
+
+#if defined(_WIN32)
+	HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (f == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER length;
+	if (!GetFileSizeEx(f, &length) || length.QuadPart == 0) {
+		CloseHandle(f);
+		return false;
+	}
+
+	HANDLE m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m) {
+		CloseHandle(f);
+		return false;
+	}
+
+	void* view = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+	if (!view) {
+		CloseHandle(m);
+		CloseHandle(f);
+		return false;
+	}
+
+	file = (void*)f;
+	mapping = (void*)m;
+	data = (const unsigned char*)view;
+	size = (size_t)length.QuadPart;
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		return false;
+	}
+
+	void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping keeps the file alive on its own
+	close(fd);
+	if (view == MAP_FAILED)
+		return false;
+
+	data = (const unsigned char*)view;
+	size = (size_t)st.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::Close() {
+	if (!data)
+		return;
+
+#if defined(_WIN32)
+	UnmapViewOfFile((const void*)data);
+	CloseHandle((HANDLE)mapping);
+	CloseHandle((HANDLE)file);
+	mapping = nullptr;
+	file = nullptr;
+#else
+	munmap((void*)data, size);
+#endif
+	data = nullptr;
+	size = 0;
+}
+
+bool MappedFile::IsOpen() const {
+	return data != nullptr;
+}
+
+const unsigned char* MappedFile::Data() const {
+	return data;
+}
+
+size_t MappedFile::Size() const {
+	return size;
+}
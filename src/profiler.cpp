@@ -0,0 +1,225 @@
+#include <algorithm>
+
+#include "gpu.h"
+#include "helpers.h"
+#include "profiler.h"
+#include "raylib.h"
+
+namespace {
+	const char* PHASE_NAMES[PROFILE_PHASE_COUNT] = {
+		"Frame",
+		"Tablet input",
+		"Key events",
+		"Tool input",
+		"Layers",
+		"Color picker",
+		"Layer UI",
+		"Readback/upload",
+	};
+
+	Profiler shared;
+}
+
+const char* ProfilePhaseName(int phase) {
+	if (phase < 0 || phase >= PROFILE_PHASE_COUNT)
+		return "?";
+	return PHASE_NAMES[phase];
+}
+
+Profiler::Profiler()
+	: history(PROFILE_HISTORY)
+{
+}
+
+void Profiler::BeginFrame() {
+	std::fill(cpu, cpu + PROFILE_PHASE_COUNT, 0.0);
+	Begin(PROFILE_FRAME);
+}
+
+void Profiler::EndFrame() {
+	End(PROFILE_FRAME);
+
+	Frame& f = history[frames % PROFILE_HISTORY];
+	for (int i = 0; i < PROFILE_PHASE_COUNT; ++i) {
+		f.cpu[i] = (float)cpu[i];
+		f.gpu[i] = -1.0f;
+	}
+
+	if (!spans.empty()) {
+		inFlight.push_back(InFlight{ frames, std::move(spans) });
+		spans.clear();
+	}
+	++frames;
+
+	// a driver that never gets to them shouldn't pile queries up
+	while (inFlight.size() > PROFILE_GPU_LATENCY) {
+		drop(inFlight.front());
+		inFlight.pop_front();
+	}
+	collect();
+}
+
+void Profiler::Begin(int phase) {
+	if (depth[phase]++ > 0)
+		return;
+	started[phase] = Clock::now();
+	stamped[phase] = gpuTiming ? GpuTimestamp() : 0;
+}
+
+void Profiler::End(int phase) {
+	if (depth[phase] == 0 || --depth[phase] > 0)
+		return;
+	cpu[phase] += std::chrono::duration<double, std::milli>(Clock::now() - started[phase]).count();
+
+	if (stamped[phase]) {
+		unsigned int end = GpuTimestamp();
+		if (end)
+			spans.push_back(Span{ phase, stamped[phase], end });
+		else
+			ReleaseGpuTimestamp(stamped[phase]);
+		stamped[phase] = 0;
+	}
+}
+
+// Frames finish on the GPU in order, so only the front is checked and
+// everything behind it waits its turn.
+void Profiler::collect() {
+	while (!inFlight.empty()) {
+		InFlight& f = inFlight.front();
+		uint64_t last = 0;
+		if (!ReadGpuTimestamp(f.spans.back().end, &last))
+			return;
+
+		float gpu[PROFILE_PHASE_COUNT] = {};
+		bool measured[PROFILE_PHASE_COUNT] = {};
+		for (const Span& s : f.spans) {
+			uint64_t begin = 0, end = 0;
+			if (ReadGpuTimestamp(s.begin, &begin) && ReadGpuTimestamp(s.end, &end) && end >= begin) {
+				gpu[s.phase] += (float)((end - begin) / 1e6);
+				measured[s.phase] = true;
+			}
+		}
+
+		// only if the slot hasn't been reused by a newer frame
+		if (frames - f.frame <= PROFILE_HISTORY) {
+			Frame& slot = history[f.frame % PROFILE_HISTORY];
+			for (int i = 0; i < PROFILE_PHASE_COUNT; ++i)
+				if (measured[i])
+					slot.gpu[i] = gpu[i];
+		}
+		drop(f);
+		inFlight.pop_front();
+	}
+}
+
+void Profiler::drop(InFlight& f) {
+	for (const Span& s : f.spans) {
+		ReleaseGpuTimestamp(s.begin);
+		ReleaseGpuTimestamp(s.end);
+	}
+	f.spans.clear();
+}
+
+void Profiler::percentiles(int phase, bool gpu, float out[3]) const {
+	size_t count = std::min(frames, (size_t)PROFILE_HISTORY);
+	std::vector<float> values;
+	values.reserve(count);
+	for (size_t i = 0; i < count; ++i) {
+		float v = gpu ? history[i].gpu[phase] : history[i].cpu[phase];
+		if (v >= 0.0f)
+			values.push_back(v);
+	}
+	if (values.empty()) {
+		out[0] = out[1] = out[2] = -1.0f;
+		return;
+	}
+
+	const float ranks[3] = { 0.50f, 0.95f, 0.99f };
+	for (int i = 0; i < 3; ++i) {
+		size_t k = std::min(values.size() - 1, (size_t)(ranks[i] * values.size()));
+		std::nth_element(values.begin(), values.begin() + k, values.end());
+		out[i] = values[k];
+	}
+}
+
+bool Profiler::Visible() const {
+	return visible;
+}
+
+void Profiler::SetVisible(bool visible) {
+	this->visible = visible;
+	gpuTiming = visible && GpuTimestampsSupported();
+
+	// stamps from before are for frames nobody's looking at anymore
+	for (int i = 0; i < PROFILE_PHASE_COUNT; ++i) {
+		ReleaseGpuTimestamp(stamped[i]);
+		stamped[i] = 0;
+	}
+	for (Span& s : spans) {
+		ReleaseGpuTimestamp(s.begin);
+		ReleaseGpuTimestamp(s.end);
+	}
+	spans.clear();
+}
+
+void Profiler::Draw() const {
+	if (!visible)
+		return;
+
+	const int width = 560;
+	const int rowHeight = 20;
+	const int graphHeight = 120;
+	int height = 40 + rowHeight * (PROFILE_PHASE_COUNT + 1) + graphHeight;
+	int x = GetScreenWidth() - width - 10;
+	int y = GetScreenHeight() - height - 10;
+
+	DrawRectangle(x, y, width, height, Fade(BLACK, 0.75f));
+	DrawTextContrast("Profiler (ms)", x + 10, y + 8, 20, WHITE);
+	DrawTextContrast("CPU p50  p95  p99", x + 190, y + 8, 20, LIGHTGRAY);
+	DrawTextContrast(gpuTiming ? "GPU p50  p95  p99" : "GPU n/a", x + 380, y + 8, 20, LIGHTGRAY);
+
+	int row = y + 40;
+	for (int i = 0; i < PROFILE_PHASE_COUNT; ++i) {
+		float c[3], g[3];
+		percentiles(i, false, c);
+		percentiles(i, true, g);
+		Color color = i == PROFILE_FRAME ? YELLOW : WHITE;
+		DrawTextContrast(PHASE_NAMES[i], x + 10, row, rowHeight - 2, color);
+		if (c[0] >= 0.0f)
+			DrawTextContrast(TextFormat("%5.2f %5.2f %5.2f", c[0], c[1], c[2]), x + 190, row, rowHeight - 2, color);
+		if (g[0] >= 0.0f)
+			DrawTextContrast(TextFormat("%5.2f %5.2f %5.2f", g[0], g[1], g[2]), x + 380, row, rowHeight - 2, color);
+		row += rowHeight;
+	}
+
+	// oldest frame on the left, bars scaled so 33ms fills the graph
+	const float scaleMs = 33.3f;
+	int gx = x + 10;
+	int gw = width - 20;
+	int gy = row + 10;
+	float barWidth = (float)gw / PROFILE_HISTORY;
+	size_t count = std::min(frames, (size_t)PROFILE_HISTORY);
+	for (size_t n = 0; n < count; ++n) {
+		size_t frame = frames - count + n;
+		const Frame& f = history[frame % PROFILE_HISTORY];
+		float bx = gx + (PROFILE_HISTORY - count + n) * barWidth;
+
+		float cpuH = std::min(f.cpu[PROFILE_FRAME] / scaleMs, 1.0f) * graphHeight;
+		Color color = f.cpu[PROFILE_FRAME] > 33.3f ? RED : f.cpu[PROFILE_FRAME] > 16.7f ? ORANGE : GREEN;
+		DrawRectangleRec(Rectangle{ bx, gy + graphHeight - cpuH, std::max(barWidth - 1.0f, 1.0f), cpuH }, Fade(color, 0.8f));
+
+		if (f.gpu[PROFILE_FRAME] >= 0.0f) {
+			float gpuH = std::min(f.gpu[PROFILE_FRAME] / scaleMs, 1.0f) * graphHeight;
+			DrawRectangleRec(Rectangle{ bx, gy + graphHeight - gpuH, std::max(barWidth - 1.0f, 1.0f), 2.0f }, SKYBLUE);
+		}
+	}
+	int line60 = gy + graphHeight - (int)(16.7f / scaleMs * graphHeight);
+	DrawLine(gx, line60, gx + gw, line60, Fade(WHITE, 0.5f));
+	DrawLine(gx, gy, gx + gw, gy, Fade(WHITE, 0.5f));
+	DrawTextContrast("16.7", gx + gw - 30, line60 - 12, 10, WHITE);
+	DrawTextContrast("33.3", gx + gw - 30, gy + 2, 10, WHITE);
+}
+
+Profiler& SharedProfiler() {
+	return shared;
+}
@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+
+#include "compositor.h"
+#include "save_worker.h"
+
+SaveWorker::~SaveWorker() {
+	writer.Wait();
+	if (job && job->composite.data)
+		UnloadImage(job->composite);
+}
+
+bool SaveWorker::Start(const std::string& path, CanvasFileData data, std::vector<Readback> reads,
+		Readback compositeRead, DirtyRect compositeRegion, const std::string& pngPath, bool append, PNG_LEVEL pngLevel)
+{
+	if (Busy())
+		return false;
+
+	job = std::make_shared<Job>();
+	job->path = path;
+	job->pngPath = pngPath;
+	job->data = std::move(data);
+	job->reads = std::move(reads);
+	job->compositeRead = std::move(compositeRead);
+	job->compositeRegion = compositeRegion;
+	job->append = append;
+	job->pngLevel = pngLevel;
+	job->data.layers.resize(job->reads.size());
+	progress = 0.0f;
+	return true;
+}
+
+// With every layer's pixels at hand the composite is done here instead of
+// in a render texture, so the GPU never holds a second canvas-sized copy.
+void SaveWorker::flatten(const CanvasFileData& data, Image& out) {
+	std::vector<CompositeLayer> layers;
+	for (const CanvasFileLayer& layer : data.layers) {
+		if (layer.pixels.empty())
+			return;
+		layers.push_back(CompositeLayer{ layer.pixels.data(), layer.opacity, layer.blendMode });
+	}
+	if (layers.empty())
+		return;
+
+	out.data = MemAlloc((unsigned int)((size_t)data.width * data.height * 4));
+	out.width = data.width;
+	out.height = data.height;
+	out.mipmaps = 1;
+	out.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+	CompositeLayers(layers, data.width, data.height, (unsigned char*)out.data, true);
+}
+
+void SaveWorker::submit() {
+	writing = true;
+	std::shared_ptr<Job> current = job;
+	writer.Submit([this, current] {
+		const DirtyRect& region = current->compositeRegion;
+		bool patch = !region.Empty();
+		Image& composite = current->composite;
+		if (!composite.data && !patch)
+			flatten(current->data, composite);
+		bool hasPng = composite.data && !patch && !current->pngPath.empty();
+		float fileShare = hasPng ? 0.8f : 0.9f;
+
+		// only a part of the canvas changed since the last save, or none of it
+		bool kept = current->append && previewsPath == current->path;
+		std::vector<CanvasFilePreview>& filePreviews = current->data.previews;
+		if (patch) {
+			if (kept && composite.data && UpdateCanvasPreviews((const unsigned char*)composite.data, region.x, region.y,
+					region.w, region.h, current->data.width, current->data.height, previews))
+				filePreviews = previews;
+		} else if (composite.data) {
+			BuildCanvasPreviews((const unsigned char*)composite.data, composite.width, composite.height, filePreviews);
+		} else if (kept) {
+			filePreviews = previews;
+		}
+
+		auto onProgress = [this, fileShare](float done) {
+			progress = 0.1f + fileShare * done;
+		};
+		CanvasFileSpace space;
+		size_t layerCount = current->data.layers.size();
+		bool ok = current->append
+			? AppendCanvasFile(current->path, current->data, onProgress, &space)
+			: SaveCanvasFile(current->path, current->data, onProgress, &space);
+		// pixels aren't needed past this point
+		current->data.layers.clear();
+		if (ok && !filePreviews.empty()) {
+			previews = std::move(filePreviews);
+			previewsPath = current->path;
+		} else {
+			previews.clear();
+			previewsPath.clear();
+		}
+		current->data.previews.clear();
+
+		bool exported = false;
+		if (ok && hasPng) {
+			// the format comes from the extension, keep it last
+			std::string tmpPath = current->pngPath + ".tmp" + std::filesystem::path(current->pngPath).extension().string();
+			exported = ExportPixels(tmpPath, (const unsigned char*)composite.data, composite.width, composite.height, current->pngLevel);
+			if (exported) {
+				std::error_code err;
+				std::filesystem::rename(tmpPath, current->pngPath, err);
+				exported = !err;
+			}
+			if (!exported)
+				std::remove(tmpPath.c_str());
+		}
+		if (composite.data)
+			UnloadImage(composite);
+		composite = {};
+		progress = 1.0f;
+
+		std::lock_guard<std::mutex> guard(lock);
+		finished = true;
+		result = SaveResult{ ok && (exported || !hasPng), exported, current->append, current->path, current->pngPath, layerCount, space };
+	});
+}
+
+bool SaveWorker::Poll(SaveResult* out) {
+	if (!job)
+		return false;
+
+	if (!writing) {
+		// copy layers out in order as they land, a frame or two behind the save
+		while (job->resolved < job->reads.size()
+				&& (!job->reads[job->resolved].Valid() || job->reads[job->resolved].Ready())) {
+			Readback& read = job->reads[job->resolved];
+			if (!read.Valid()) {
+				job->resolved++;
+				continue;
+			}
+			CanvasFileLayer& layer = job->data.layers[job->resolved];
+			layer.pixels.resize((size_t)read.Width() * read.Height() * 4);
+			read.Resolve(layer.pixels.data());
+			job->resolved++;
+		}
+		progress = 0.1f * job->resolved / std::max((size_t)1, job->reads.size());
+
+		bool compositeReady = !job->compositeRead.Valid() || job->compositeRead.Ready();
+		if (job->resolved == job->reads.size() && compositeReady) {
+			if (job->compositeRead.Valid())
+				job->composite = job->compositeRead.ResolveImage();
+			job->reads.clear();
+			submit();
+		}
+		return false;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (!finished)
+		return false;
+	finished = false;
+	writing = false;
+	job = nullptr;
+	if (out)
+		*out = result;
+	return true;
+}
+
+bool SaveWorker::Finish(SaveResult* out) {
+	if (!job)
+		return false;
+
+	if (!writing) {
+		for (size_t i = job->resolved; i < job->reads.size(); ++i) {
+			Readback& read = job->reads[i];
+			if (!read.Valid())
+				continue;
+			CanvasFileLayer& layer = job->data.layers[i];
+			layer.pixels.resize((size_t)read.Width() * read.Height() * 4);
+			read.Resolve(layer.pixels.data());
+		}
+		job->resolved = job->reads.size();
+		if (job->compositeRead.Valid())
+			job->composite = job->compositeRead.ResolveImage();
+		job->reads.clear();
+		submit();
+	}
+	writer.Wait();
+	return Poll(out);
+}
+
+bool SaveWorker::HasPreviews(const std::string& path, int width, int height) const {
+	return !previews.empty() && previewsPath == path
+		&& previews.front().width == std::max(1, (width + 1) / 2)
+		&& previews.front().height == std::max(1, (height + 1) / 2);
+}
+
+void SaveWorker::DropPreviews() {
+	writer.Wait();
+	previews.clear();
+	previewsPath.clear();
+}
+
+bool SaveWorker::Busy() const {
+	return job != nullptr;
+}
+
+float SaveWorker::Progress() const {
+	return progress;
+}
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "scratch_file.h"
+
+ScratchFile::~ScratchFile() {
+#if defined(_WIN32)
+	if (handle)
+		CloseHandle((HANDLE)handle);
+#else
+	if (fd >= 0)
+		close(fd);
+#endif
+}
+
+bool ScratchFile::open() {
+	if (failed)
+		return false;
+
+#if defined(_WIN32)
+	if (handle)
+		return true;
+
+	char dir[MAX_PATH + 1];
+	char path[MAX_PATH + 1];
+	if (!GetTempPathA(sizeof(dir), dir) || !GetTempFileNameA(dir, "mcs", 0, path)) {
+		failed = true;
+		return false;
+	}
+
+	HANDLE h = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+	if (h == INVALID_HANDLE_VALUE) {
+		failed = true;
+		return false;
+	}
+	handle = (void*)h;
+#else
+	if (fd >= 0)
+		return true;
+
+	const char* dir = getenv("TMPDIR");
+	std::string path = std::string(dir && *dir ? dir : "/tmp") + "/mycanvas-XXXXXX";
+	fd = mkstemp(&path[0]);
+	if (fd < 0) {
+		failed = true;
+		return false;
+	}
+	// nobody else needs to see it, and it goes away even if we crash
+	unlink(path.c_str());
+#endif
+	return true;
+}
+
+uint64_t ScratchFile::allocate(uint64_t size) {
+	for (size_t i = 0; i < freeList.size(); ++i) {
+		Extent& e = freeList[i];
+		if (e.size < size)
+			continue;
+
+		uint64_t offset = e.offset;
+		e.offset += size;
+		e.size -= size;
+		if (e.size == 0)
+			freeList.erase(freeList.begin() + i);
+		return offset;
+	}
+
+	uint64_t offset = end;
+	end += size;
+	return offset;
+}
+
+bool ScratchFile::Write(const void* data, size_t size, uint64_t* offset) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (!open())
+			return false;
+		*offset = allocate(size);
+		used += size;
+	}
+
+	const char* src = (const char*)data;
+	uint64_t at = *offset;
+	size_t left = size;
+	while (left > 0) {
+#if defined(_WIN32)
+		OVERLAPPED ov = {};
+		ov.Offset = (DWORD)(at & 0xFFFFFFFFu);
+		ov.OffsetHigh = (DWORD)(at >> 32);
+		DWORD chunk = (DWORD)std::min(left, (size_t)1 << 30);
+		DWORD written = 0;
+		if (!WriteFile((HANDLE)handle, src, chunk, &written, &ov) || written == 0)
+			break;
+#else
+		ssize_t written = pwrite(fd, src, left, (off_t)at);
+		if (written <= 0)
+			break;
+#endif
+		src += written;
+		at += written;
+		left -= written;
+	}
+
+	// most likely the disk is full, later writes wouldn't fare better
+	if (left > 0) {
+		Free(*offset, size);
+		failed = true;
+		return false;
+	}
+	return true;
+}
+
+bool ScratchFile::Read(uint64_t offset, void* out, size_t size) {
+	char* dst = (char*)out;
+	size_t left = size;
+	while (left > 0) {
+#if defined(_WIN32)
+		OVERLAPPED ov = {};
+		ov.Offset = (DWORD)(offset & 0xFFFFFFFFu);
+		ov.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD chunk = (DWORD)std::min(left, (size_t)1 << 30);
+		DWORD got = 0;
+		if (!ReadFile((HANDLE)handle, dst, chunk, &got, &ov) || got == 0)
+			return false;
+#else
+		ssize_t got = pread(fd, dst, left, (off_t)offset);
+		if (got <= 0)
+			return false;
+#endif
+		dst += got;
+		offset += got;
+		left -= got;
+	}
+	return true;
+}
+
+void ScratchFile::Free(uint64_t offset, size_t size) {
+	std::lock_guard<std::mutex> guard(lock);
+	used -= size;
+
+	auto it = std::lower_bound(freeList.begin(), freeList.end(), offset,
+			[](const Extent& e, uint64_t at) { return e.offset < at; });
+	it = freeList.insert(it, Extent{ offset, size });
+
+	// merge with the neighbours so big blocks can be reused later
+	if (it + 1 != freeList.end() && it->offset + it->size == (it + 1)->offset) {
+		it->size += (it + 1)->size;
+		freeList.erase(it + 1);
+	}
+	if (it != freeList.begin() && (it - 1)->offset + (it - 1)->size == it->offset) {
+		(it - 1)->size += it->size;
+		it = freeList.erase(it) - 1;
+	}
+	if (it->offset + it->size == end) {
+		end = it->offset;
+		freeList.erase(it);
+	}
+}
+
+bool ScratchFile::Usable() const {
+	return !failed;
+}
+
+uint64_t ScratchFile::UsedBytes() {
+	std::lock_guard<std::mutex> guard(lock);
+	return used;
+}
@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <cmath>
+
+#include "stroke_log.h"
+#include "helpers.h"
+#include "raylib.h"
+#include "tile_codec.h"
+
+StrokeLog::StrokeLog(size_t interval, size_t budget)
+	: interval(std::max(interval, (size_t)1)), budget(budget)
+{
+}
+
+StrokeLog::~StrokeLog() {
+	Clear();
+	compressor.Wait();
+}
+
+StrokeLog::LayerLog& StrokeLog::log_for(size_t layer) {
+	if (layer >= logs.size())
+		logs.resize(layer + 1);
+	return logs[layer];
+}
+
+void StrokeLog::snapshot(LayerLog& log, size_t at, const Layer& layer) {
+	if (log.keyframes.count(at))
+		return;
+
+	KeyframePtr keyframe = std::make_shared<StrokeKeyframe>();
+	keyframe->width = layer.width;
+	keyframe->height = layer.height;
+	keyframe->serial = nextSerial++;
+	keyframe->bytes = (size_t)layer.width * layer.height * 4;
+	keyframe->read = Readback(layer.tex);
+
+	keyframeBytes += keyframe->bytes;
+	keyframeCount++;
+	log.keyframes[at] = keyframe;
+	settling.push_back(keyframe);
+}
+
+bool StrokeLog::restore_keyframe(StrokeKeyframe& keyframe, const Layer& layer) {
+	if (keyframe.width != layer.width || keyframe.height != layer.height)
+		return false;
+
+	std::lock_guard<std::mutex> guard(keyframe.lock);
+	if (keyframe.read.Valid()) {
+		keyframe.pixels.resize(keyframe.bytes);
+		keyframe.read.Resolve(keyframe.pixels.data());
+		keyframe.read = Readback();
+	}
+	if (!keyframe.pixels.empty()) {
+		WriteTextureRegion(layer.tex, 0, 0, layer.width, layer.height, keyframe.pixels.data());
+		return true;
+	}
+
+	// a whole layer, often well past the 64 MB DecompressData() stops at
+	std::vector<unsigned char> pixels((size_t)keyframe.width * keyframe.height * 4);
+	if (!InflateExact(keyframe.packed.data(), keyframe.packed.size(), pixels.data(), pixels.size()))
+		return false;
+	WriteTextureRegion(layer.tex, 0, 0, layer.width, layer.height, pixels.data());
+	return true;
+}
+
+void StrokeLog::replay(const StrokeCommand& command, const Layer& layer) {
+	Vector2 prev = { 0, 0 };
+	for (const StrokePoint& point : command.points) {
+		if (!point.moveTo)
+			DrawStrokeSegment(layer.tex, prev, point.pos, command.size * point.pressure, command.color, command.isBrush);
+		prev = point.pos;
+	}
+}
+
+// the rebuild only differs from before inside the stroke's own bounds
+void StrokeLog::report(const StrokeCommand& command, const Layer& layer) {
+	if (!onRestore || command.points.empty())
+		return;
+
+	float pad = command.size + 2.0f;
+	float x0 = command.points[0].pos.x, x1 = x0;
+	float y0 = command.points[0].pos.y, y1 = y0;
+	for (const StrokePoint& point : command.points) {
+		x0 = std::min(x0, point.pos.x);
+		x1 = std::max(x1, point.pos.x);
+		y0 = std::min(y0, point.pos.y);
+		y1 = std::max(y1, point.pos.y);
+	}
+	int left   = (int)floorf(x0 - pad);
+	int right  = (int)ceilf(x1 + pad);
+	int top    = (int)floorf(y0 - pad);
+	int bottom = (int)ceilf(y1 + pad);
+	onRestore(command.layer, left, layer.height - bottom, right - left, bottom - top);
+}
+
+void StrokeLog::drop_keyframe(const KeyframePtr& keyframe) {
+	std::lock_guard<std::mutex> guard(keyframe->lock);
+	if (keyframe->dropped)
+		return;
+	keyframe->dropped = true;
+	keyframe->read = Readback();
+	std::vector<unsigned char>().swap(keyframe->pixels);
+	std::vector<unsigned char>().swap(keyframe->packed);
+	keyframeBytes -= keyframe->bytes;
+	keyframe->bytes = 0;
+	keyframeCount--;
+}
+
+void StrokeLog::trim() {
+	while (keyframeBytes > budget) {
+		// oldest base keyframe that has a newer one to fall back on
+		LayerLog* victim = nullptr;
+		size_t victimIndex = 0;
+		for (size_t i = 0; i < logs.size(); ++i) {
+			LayerLog& log = logs[i];
+			if (log.keyframes.size() < 2)
+				continue;
+			auto next = std::next(log.keyframes.begin());
+			if (next->first > log.applied)
+				continue;
+			if (!victim || log.keyframes.begin()->second->serial < victim->keyframes.begin()->second->serial) {
+				victim = &log;
+				victimIndex = i;
+			}
+		}
+		if (!victim)
+			break;
+
+		drop_keyframe(victim->keyframes.begin()->second);
+		victim->keyframes.erase(victim->keyframes.begin());
+
+		// strokes below the new base can't be undone anymore
+		size_t newFloor = victim->keyframes.begin()->first;
+		size_t forget = newFloor - victim->floor;
+		for (size_t i = victim->floor; i < newFloor; ++i) {
+			commandBytes -= victim->strokes[i].points.size() * sizeof(StrokePoint);
+			std::vector<StrokePoint>().swap(victim->strokes[i].points);
+		}
+		victim->floor = newFloor;
+
+		for (auto it = undoOrder.begin(); it != undoOrder.end() && forget > 0;) {
+			if (*it == victimIndex) {
+				it = undoOrder.erase(it);
+				forget--;
+			} else {
+				++it;
+			}
+		}
+	}
+}
+
+void StrokeLog::BeginStroke(const Layer& layer, size_t layerIndex, Color color, float size, bool isBrush) {
+	if (isRecording)
+		EndStroke(layer);
+
+	LayerLog& log = log_for(layerIndex);
+	if (log.keyframes.empty())
+		snapshot(log, log.applied, layer);
+
+	pending = StrokeCommand{ layerIndex, color, size, isBrush, {} };
+	isRecording = true;
+}
+
+void StrokeLog::AddSegment(Vector2 from, Vector2 to, float radius) {
+	if (!isRecording)
+		return;
+
+	float pressure = pending.size > 0.0f ? radius / pending.size : 0.0f;
+	std::vector<StrokePoint>& points = pending.points;
+	if (points.empty() || points.back().pos.x != from.x || points.back().pos.y != from.y)
+		points.push_back(StrokePoint{ from, pressure, true });
+	points.push_back(StrokePoint{ to, pressure, false });
+}
+
+void StrokeLog::EndStroke(const Layer& layer) {
+	if (!isRecording)
+		return;
+	isRecording = false;
+
+	if (pending.points.empty())
+		return;
+
+	// a new stroke forks history, forget everything that was undone
+	for (size_t index : redoOrder) {
+		LayerLog& log = logs[index];
+		for (size_t i = log.applied; i < log.strokes.size(); ++i)
+			commandBytes -= log.strokes[i].points.size() * sizeof(StrokePoint);
+		log.strokes.resize(log.applied);
+		for (auto it = log.keyframes.upper_bound(log.applied); it != log.keyframes.end();) {
+			drop_keyframe(it->second);
+			it = log.keyframes.erase(it);
+		}
+	}
+	redoOrder.clear();
+
+	size_t index = pending.layer;
+	LayerLog& log = log_for(index);
+	commandBytes += pending.points.size() * sizeof(StrokePoint);
+	log.strokes.push_back(std::move(pending));
+	log.applied++;
+	undoOrder.push_back(index);
+	pending = StrokeCommand{};
+
+	if (log.applied % interval == 0)
+		snapshot(log, log.applied, layer);
+	trim();
+}
+
+void StrokeLog::Update() {
+	for (size_t i = 0; i < settling.size();) {
+		KeyframePtr keyframe = settling[i];
+		{
+			std::lock_guard<std::mutex> guard(keyframe->lock);
+			if (!keyframe->dropped && keyframe->read.Valid()) {
+				if (!keyframe->read.Ready()) {
+					++i;
+					continue;
+				}
+				keyframe->pixels.resize(keyframe->bytes);
+				keyframe->read.Resolve(keyframe->pixels.data());
+				keyframe->read = Readback();
+			}
+		}
+		settling.erase(settling.begin() + i);
+		if (keyframe->dropped)
+			continue;
+
+		compressor.Submit([this, keyframe] {
+			std::lock_guard<std::mutex> guard(keyframe->lock);
+			if (keyframe->dropped || keyframe->pixels.empty())
+				return;
+
+			int size = 0;
+			unsigned char* data = CompressData(keyframe->pixels.data(), (int)keyframe->pixels.size(), &size);
+			if (!data)
+				return;
+			keyframe->packed.assign(data, data + size);
+			MemFree(data);
+			std::vector<unsigned char>().swap(keyframe->pixels);
+
+			keyframeBytes -= keyframe->bytes;
+			keyframe->bytes = keyframe->packed.size();
+			keyframeBytes += keyframe->bytes;
+		});
+	}
+}
+
+bool StrokeLog::Undo(std::deque<Layer>& layers) {
+	if (isRecording && pending.layer < layers.size())
+		EndStroke(layers[pending.layer]);
+	if (undoOrder.empty())
+		return false;
+
+	size_t index = undoOrder.back();
+	if (index >= layers.size())
+		return false;
+
+	LayerLog& log = logs[index];
+	const Layer& layer = layers[index];
+
+	// rebuild from the nearest keyframe at or below the new position, and
+	// only count the undo once the layer really went back
+	auto it = std::prev(log.keyframes.upper_bound(log.applied - 1));
+	if (!restore_keyframe(*it->second, layer))
+		return false;
+	undoOrder.pop_back();
+	log.applied--;
+	redoOrder.push_back(index);
+	for (size_t i = it->first; i < log.applied; ++i)
+		replay(log.strokes[i], layer);
+	report(log.strokes[log.applied], layer);
+	return true;
+}
+
+bool StrokeLog::Redo(std::deque<Layer>& layers) {
+	if (isRecording && pending.layer < layers.size())
+		EndStroke(layers[pending.layer]);
+	if (redoOrder.empty())
+		return false;
+
+	size_t index = redoOrder.back();
+	if (index >= layers.size())
+		return false;
+	redoOrder.pop_back();
+
+	LayerLog& log = logs[index];
+	replay(log.strokes[log.applied], layers[index]);
+	report(log.strokes[log.applied], layers[index]);
+	log.applied++;
+	undoOrder.push_back(index);
+	return true;
+}
+
+void StrokeLog::SwapLayers(size_t a, size_t b) {
+	log_for(std::max(a, b));
+	std::swap(logs[a], logs[b]);
+	for (LayerLog* log : { &logs[a], &logs[b] })
+		for (StrokeCommand& command : log->strokes)
+			command.layer = (log == &logs[a]) ? a : b;
+
+	auto remap = [a, b](size_t& index) {
+		if (index == a)
+			index = b;
+		else if (index == b)
+			index = a;
+	};
+	for (size_t& index : undoOrder)
+		remap(index);
+	for (size_t& index : redoOrder)
+		remap(index);
+	if (isRecording)
+		remap(pending.layer);
+}
+
+void StrokeLog::Clear() {
+	for (LayerLog& log : logs)
+		for (auto& kv : log.keyframes)
+			drop_keyframe(kv.second);
+	logs.clear();
+	undoOrder.clear();
+	redoOrder.clear();
+	settling.clear();
+	pending = StrokeCommand{};
+	isRecording = false;
+	commandBytes = 0;
+}
+
+bool StrokeLog::Settling() const {
+	return !settling.empty();
+}
+
+StrokeLogStats StrokeLog::Stats() const {
+	return StrokeLogStats{ undoOrder.size(), redoOrder.size(), keyframeCount, keyframeBytes.load(), commandBytes };
+}
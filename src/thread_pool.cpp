@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(size_t threads) {
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (size_t i = 0; i < threads; ++i)
+		workers.emplace_back([this] { work(); });
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& t : workers)
+		t.join();
+}
+
+void ThreadPool::Submit(std::function<void()> job) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		jobs.push_back(std::move(job));
+	}
+	wake.notify_one();
+}
+
+void ThreadPool::Wait() {
+	std::unique_lock<std::mutex> guard(lock);
+	done.wait(guard, [this] { return jobs.empty() && running == 0; });
+}
+
+size_t ThreadPool::Size() const {
+	return workers.size();
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& fn) {
+	if (count == 0)
+		return;
+
+	struct Batch {
+		std::atomic<size_t> next{0};
+		size_t finished = 0;
+		std::mutex lock;
+		std::condition_variable done;
+	};
+	std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+	const std::function<void(size_t)>* body = &fn;
+
+	// helpers that start after the batch is drained touch nothing but the batch
+	auto run = [batch, body, count] {
+		size_t n = 0;
+		for (size_t i = batch->next++; i < count; i = batch->next++) {
+			(*body)(i);
+			n++;
+		}
+		if (n == 0)
+			return;
+		std::lock_guard<std::mutex> guard(batch->lock);
+		batch->finished += n;
+		if (batch->finished == count)
+			batch->done.notify_all();
+	};
+
+	size_t helpers = std::min(workers.size(), count - 1);
+	for (size_t i = 0; i < helpers; ++i)
+		Submit(run);
+	run();
+
+	std::unique_lock<std::mutex> guard(batch->lock);
+	batch->done.wait(guard, [&] { return batch->finished == count; });
+}
+
+ThreadPool& SharedPool() {
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::work() {
+	for (;;) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this] { return stopping || !jobs.empty(); });
+			if (jobs.empty())
+				return;
+
+			job = std::move(jobs.front());
+			jobs.pop_front();
+			running++;
+		}
+
+		job();
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			running--;
+			if (jobs.empty() && running == 0)
+				done.notify_all();
+		}
+	}
+}
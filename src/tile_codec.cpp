@@ -0,0 +1,513 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "raylib.h"
+#include "tile_codec.h"
+
+namespace {
+
+enum RUN_OP {
+	OP_LITERAL = 0x00,
+	OP_REPEAT  = 0x40,
+	OP_ABOVE   = 0x80,
+	OP_ZERO    = 0xC0
+};
+
+inline uint32_t load(const unsigned char* p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+void put_op(std::vector<unsigned char>& out, RUN_OP op, size_t length) {
+	if (length < 64) {
+		out.push_back((unsigned char)(op | (length - 1)));
+		return;
+	}
+	out.push_back((unsigned char)(op | 63));
+	size_t rest = length - 64;
+	while (rest >= 0x80) {
+		out.push_back((unsigned char)(rest | 0x80));
+		rest >>= 7;
+	}
+	out.push_back((unsigned char)rest);
+}
+
+void encode_runs(const unsigned char* pixels, int width, int height, std::vector<unsigned char>& out) {
+	size_t count = (size_t)width * height;
+	size_t i = 0;
+	size_t literals = 0;
+
+	auto flush = [&]() {
+		if (!literals)
+			return;
+		put_op(out, OP_LITERAL, literals);
+		const unsigned char* from = pixels + (i - literals) * 4;
+		out.insert(out.end(), from, from + literals * 4);
+		literals = 0;
+	};
+
+	while (i < count) {
+		uint32_t px = load(pixels + i * 4);
+		size_t zero = 0, repeat = 0, above = 0;
+		if (px == 0)
+			while (i + zero < count && load(pixels + (i + zero) * 4) == 0)
+				zero++;
+		if (i > 0 && px == load(pixels + (i - 1) * 4)) {
+			uint32_t prev = px;
+			while (i + repeat < count && load(pixels + (i + repeat) * 4) == prev)
+				repeat++;
+		}
+		if (i >= (size_t)width && px == load(pixels + (i - width) * 4))
+			while (i + above < count && load(pixels + (i + above) * 4) == load(pixels + (i + above - width) * 4))
+				above++;
+
+		// a run of one costs the same byte as a literal, so literals keep
+		// going until something longer shows up
+		size_t best = std::max(zero, std::max(repeat, above));
+		if (best < 2) {
+			literals++;
+			i++;
+			continue;
+		}
+		flush();
+		put_op(out, best == zero ? OP_ZERO : best == repeat ? OP_REPEAT : OP_ABOVE, best);
+		i += best;
+	}
+	flush();
+}
+
+bool decode_runs(const unsigned char* data, size_t size, int width, int height, unsigned char* out) {
+	const unsigned char* p = data;
+	const unsigned char* end = data + size;
+	size_t count = (size_t)width * height;
+	size_t i = 0;
+
+	while (p < end) {
+		unsigned char op = *p & 0xC0;
+		size_t length = (*p & 0x3F) + 1;
+		p++;
+		if (length == 64) {
+			uint64_t rest = 0;
+			for (int shift = 0;; shift += 7) {
+				if (p >= end || shift > 56)
+					return false;
+				rest |= (uint64_t)(*p & 0x7F) << shift;
+				if (!(*p++ & 0x80))
+					break;
+			}
+			if (rest > count)
+				return false;
+			length += (size_t)rest;
+		}
+		if (length > count - i)
+			return false;
+
+		unsigned char* dst = out + i * 4;
+		switch (op) {
+		case OP_LITERAL:
+			if ((size_t)(end - p) / 4 < length)
+				return false;
+			memcpy(dst, p, length * 4);
+			p += length * 4;
+			break;
+		case OP_REPEAT:
+			if (i == 0)
+				return false;
+			for (size_t k = 0; k < length; ++k)
+				memcpy(dst + k * 4, dst - 4, 4);
+			break;
+		case OP_ABOVE:
+			if (i < (size_t)width)
+				return false;
+			// the source can run into what this op writes, so go in order
+			for (size_t k = 0; k < length; ++k)
+				memcpy(dst + k * 4, dst + k * 4 - (size_t)width * 4, 4);
+			break;
+		default:
+			memset(dst, 0, length * 4);
+			break;
+		}
+		i += length;
+	}
+	return i == count;
+}
+
+// inflate, with the tables laid out the way stb_image does it: codes up
+// to FAST_BITS long resolve in one lookup, longer ones walk the lengths
+const int FAST_BITS = 9;
+
+const uint16_t LENGTH_BASE[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const uint8_t LENGTH_EXTRA[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16_t DIST_BASE[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const uint8_t DIST_EXTRA[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+const uint8_t CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+uint32_t reverse_bits(uint32_t v, int bits) {
+	uint32_t r = 0;
+	for (int i = 0; i < bits; ++i, v >>= 1)
+		r = (r << 1) | (v & 1);
+	return r;
+}
+
+struct Huffman {
+	uint16_t fast[1 << FAST_BITS];  // (length << 9) | symbol, 0 if longer
+	uint32_t maxCode[17];           // per length, left aligned to 16 bits
+	uint16_t firstCode[16];
+	uint16_t firstSymbol[16];
+	uint8_t length[288];
+	uint16_t symbol[288];
+
+	bool build(const uint8_t* lengths, int count) {
+		int counts[17] = {};
+		uint32_t next[16];
+		memset(fast, 0, sizeof(fast));
+		for (int i = 0; i < count; ++i)
+			counts[lengths[i]]++;
+		counts[0] = 0;
+
+		uint32_t code = 0;
+		int k = 0;
+		for (int bits = 1; bits < 16; ++bits) {
+			next[bits] = code;
+			firstCode[bits] = (uint16_t)code;
+			firstSymbol[bits] = (uint16_t)k;
+			code += counts[bits];
+			if (counts[bits] && code - 1 >= (1u << bits))
+				return false;
+			maxCode[bits] = code << (16 - bits);
+			code <<= 1;
+			k += counts[bits];
+		}
+		maxCode[16] = 0x10000;
+
+		for (int i = 0; i < count; ++i) {
+			int bits = lengths[i];
+			if (!bits)
+				continue;
+			int slot = (int)(next[bits] - firstCode[bits] + firstSymbol[bits]);
+			length[slot] = (uint8_t)bits;
+			symbol[slot] = (uint16_t)i;
+			if (bits <= FAST_BITS)
+				for (uint32_t j = reverse_bits(next[bits], bits); j < (1u << FAST_BITS); j += 1u << bits)
+					fast[j] = (uint16_t)((bits << FAST_BITS) | i);
+			next[bits]++;
+		}
+		return true;
+	}
+};
+
+// Bits come in LSB first. Past the end of the input it feeds zeros and
+// counts them, the caller gives up once that's more than a few bytes.
+struct BitReader {
+	const unsigned char* p;
+	const unsigned char* end;
+	uint64_t bits = 0;
+	int count = 0;
+	int overrun = 0;
+
+	void fill() {
+		while (count <= 56) {
+			uint64_t byte = 0;
+			if (p < end)
+				byte = *p++;
+			else
+				overrun++;
+			bits |= byte << count;
+			count += 8;
+		}
+	}
+
+	uint32_t take(int n) {
+		if (count < n)
+			fill();
+		uint32_t v = (uint32_t)(bits & ((1ull << n) - 1));
+		bits >>= n;
+		count -= n;
+		return v;
+	}
+
+	int decode(const Huffman& h) {
+		if (count < 16)
+			fill();
+		int entry = h.fast[bits & ((1 << FAST_BITS) - 1)];
+		if (entry) {
+			int bitsUsed = entry >> FAST_BITS;
+			bits >>= bitsUsed;
+			count -= bitsUsed;
+			return entry & ((1 << FAST_BITS) - 1);
+		}
+		uint32_t k = reverse_bits((uint32_t)bits & 0xFFFF, 16);
+		int n = FAST_BITS + 1;
+		while (n < 16 && k >= h.maxCode[n])
+			n++;
+		if (n >= 16)
+			return -1;
+		int slot = (int)((k >> (16 - n)) - h.firstCode[n] + h.firstSymbol[n]);
+		if (slot >= 288 || h.length[slot] != n)
+			return -1;
+		bits >>= n;
+		count -= n;
+		return h.symbol[slot];
+	}
+};
+
+const Huffman* fixed_tables() {
+	static Huffman tables[2];
+	static bool built = [] {
+		uint8_t lengths[288];
+		memset(lengths, 8, 144);
+		memset(lengths + 144, 9, 112);
+		memset(lengths + 256, 7, 24);
+		memset(lengths + 280, 8, 8);
+		tables[0].build(lengths, 288);
+		memset(lengths, 5, 30);
+		tables[1].build(lengths, 30);
+		return true;
+	}();
+	(void)built;
+	return tables;
+}
+
+bool read_dynamic(BitReader& in, Huffman& lit, Huffman& dist) {
+	int litCount  = (int)in.take(5) + 257;
+	int distCount = (int)in.take(5) + 1;
+	int lenCount  = (int)in.take(4) + 4;
+	if (litCount > 286 || distCount > 30)
+		return false;
+
+	uint8_t codeLengths[19] = {};
+	for (int i = 0; i < lenCount; ++i)
+		codeLengths[CODE_LENGTH_ORDER[i]] = (uint8_t)in.take(3);
+	Huffman lengthCodes;
+	if (!lengthCodes.build(codeLengths, 19))
+		return false;
+
+	uint8_t lengths[286 + 30];
+	int total = litCount + distCount;
+	int n = 0;
+	while (n < total) {
+		int sym = in.decode(lengthCodes);
+		if (sym < 0 || in.overrun > 8)
+			return false;
+		if (sym < 16) {
+			lengths[n++] = (uint8_t)sym;
+			continue;
+		}
+		int repeat;
+		uint8_t fill = 0;
+		if (sym == 16) {
+			if (n == 0)
+				return false;
+			fill = lengths[n - 1];
+			repeat = 3 + (int)in.take(2);
+		} else if (sym == 17) {
+			repeat = 3 + (int)in.take(3);
+		} else {
+			repeat = 11 + (int)in.take(7);
+		}
+		if (repeat > total - n)
+			return false;
+		memset(lengths + n, fill, repeat);
+		n += repeat;
+	}
+	return lit.build(lengths, litCount) && dist.build(lengths + litCount, distCount);
+}
+
+bool inflate_block(BitReader& in, const Huffman& lit, const Huffman& dist, unsigned char* out, size_t cap, size_t& n) {
+	for (;;) {
+		int sym = in.decode(lit);
+		if (sym < 0 || in.overrun > 8)
+			return false;
+		if (sym < 256) {
+			if (n >= cap)
+				return false;
+			out[n++] = (unsigned char)sym;
+			continue;
+		}
+		if (sym == 256)
+			return true;
+
+		sym -= 257;
+		if (sym >= 29)
+			return false;
+		size_t length = LENGTH_BASE[sym] + in.take(LENGTH_EXTRA[sym]);
+		int d = in.decode(dist);
+		if (d < 0 || d >= 30)
+			return false;
+		size_t back = DIST_BASE[d] + in.take(DIST_EXTRA[d]);
+		if (back > n || length > cap - n)
+			return false;
+
+		unsigned char* dst = out + n;
+		const unsigned char* src = dst - back;
+		if (back >= length)
+			memcpy(dst, src, length);
+		else if (back == 1)
+			memset(dst, *src, length);
+		else
+			for (size_t i = 0; i < length; ++i)
+				dst[i] = src[i];
+		n += length;
+	}
+}
+
+bool inflate_stored(BitReader& in, unsigned char* out, size_t cap, size_t& n) {
+	in.take(in.count & 7);
+	uint32_t length = in.take(16);
+	uint32_t check = in.take(16);
+	if ((length ^ 0xFFFF) != check || in.overrun * 8 > in.count || length > cap - n)
+		return false;
+	size_t buffered = (size_t)(in.count / 8 - in.overrun);
+	if (length > buffered + (size_t)(in.end - in.p))
+		return false;
+	// whatever is still buffered goes first, then straight from the input
+	while (length && in.count >= 8) {
+		out[n++] = (unsigned char)in.take(8);
+		length--;
+	}
+	memcpy(out + n, in.p, length);
+	in.p += length;
+	n += length;
+	return true;
+}
+
+bool deflate_into(const unsigned char* data, size_t size, std::vector<unsigned char>& out) {
+	int packedSize = 0;
+	unsigned char* packed = CompressData(data, (int)size, &packedSize);
+	if (!packed)
+		return false;
+	out.assign(packed, packed + packedSize);
+	MemFree(packed);
+	return true;
+}
+
+}
+
+bool EncodeTile(int codec, const unsigned char* pixels, int width, int height, std::vector<unsigned char>& out) {
+	out.clear();
+	size_t bytes = (size_t)width * height * 4;
+	switch (codec) {
+	case CANVAS_CODEC_DEFLATE:
+		return deflate_into(pixels, bytes, out);
+	case CANVAS_CODEC_RUNS:
+		encode_runs(pixels, width, height, out);
+		return true;
+	case CANVAS_CODEC_RUNS_DEFLATE: {
+		std::vector<unsigned char> runs;
+		encode_runs(pixels, width, height, runs);
+		return deflate_into(runs.data(), runs.size(), out);
+	}
+	}
+	return false;
+}
+
+bool DecodeTile(int codec, const unsigned char* data, size_t size, int width, int height, unsigned char* out, size_t stride) {
+	size_t rowBytes = (size_t)width * 4;
+	size_t bytes = rowBytes * height;
+
+	// reused across calls, a worker decodes a whole file's worth of tiles
+	// one after another and they're all about the same size
+	thread_local std::vector<unsigned char> raw;
+	thread_local std::vector<unsigned char> scratch;
+
+	auto place = [&](const unsigned char* pixels) {
+		for (int row = 0; row < height; ++row)
+			memcpy(out + (size_t)row * stride, pixels + (size_t)row * rowBytes, rowBytes);
+	};
+
+	// runs decode contiguous, a tile inside a layer goes through scratch
+	auto runs = [&](const unsigned char* blob, size_t blobSize) {
+		if (stride == rowBytes)
+			return decode_runs(blob, blobSize, width, height, out);
+		if (scratch.size() < bytes)
+			scratch.resize(bytes);
+		if (!decode_runs(blob, blobSize, width, height, scratch.data()))
+			return false;
+		place(scratch.data());
+		return true;
+	};
+
+	if (codec == CANVAS_CODEC_RUNS)
+		return runs(data, size);
+
+	if (codec == CANVAS_CODEC_RUNS_DEFLATE) {
+		// a literal pixel costs at most 5 bytes, a run covers at least two
+		size_t cap = bytes / 4 * 5 + 16;
+		if (raw.size() < cap)
+			raw.resize(cap);
+		long long rawSize = Inflate(data, size, raw.data(), cap);
+		return rawSize >= 0 && runs(raw.data(), (size_t)rawSize);
+	}
+
+	if (codec == CANVAS_CODEC_DEFLATE) {
+		if (stride == rowBytes)
+			return InflateExact(data, size, out, bytes);
+		if (raw.size() < bytes)
+			raw.resize(bytes);
+		if (!InflateExact(data, size, raw.data(), bytes))
+			return false;
+		place(raw.data());
+		return true;
+	}
+	return false;
+}
+
+long long Inflate(const unsigned char* data, size_t size, unsigned char* out, size_t cap) {
+	BitReader in = { data, data + size };
+	Huffman tables[2];
+	size_t n = 0;
+	for (;;) {
+		bool last = in.take(1);
+		uint32_t type = in.take(2);
+		bool ok = false;
+		if (type == 0) {
+			ok = inflate_stored(in, out, cap, n);
+		} else if (type == 1) {
+			const Huffman* fixed = fixed_tables();
+			ok = inflate_block(in, fixed[0], fixed[1], out, cap, n);
+		} else if (type == 2) {
+			ok = read_dynamic(in, tables[0], tables[1]) && inflate_block(in, tables[0], tables[1], out, cap, n);
+		}
+		if (!ok)
+			return -1;
+		if (last)
+			break;
+	}
+	// the last code may end in the zero padding but no further
+	if (in.overrun * 8 > in.count)
+		return -1;
+	return (long long)n;
+}
+
+bool InflateExact(const unsigned char* data, size_t size, unsigned char* out, size_t outSize) {
+	return Inflate(data, size, out, outSize) == (long long)outSize;
+}
+
+const char* CanvasCodecName(int codec) {
+	switch (codec) {
+	case CANVAS_CODEC_DEFLATE: return "deflate";
+	case CANVAS_CODEC_RUNS: return "runs";
+	case CANVAS_CODEC_RUNS_DEFLATE: return "runs+deflate";
+	default: return "unknown";
+	}
+}
+
+bool ParseCanvasCodec(const char* name, CANVAS_CODEC& out) {
+	for (int codec = 0; codec < CANVAS_CODEC_COUNT; ++codec) {
+		if (strcmp(name, CanvasCodecName(codec)) == 0) {
+			out = (CANVAS_CODEC)codec;
+			return true;
+		}
+	}
+	return false;
+}